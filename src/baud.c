@@ -0,0 +1,315 @@
+#include "baud.h"
+#include "common.h"
+#include "constants.h"
+#include "event.h"
+#include "reply.h"
+#include "txqueue.h"
+
+/* Self-test pattern, the printable ASCII characters 0x20-0x5F */
+static const char baud_test_pattern[BAUD_TEST_PATTERN_LEN] =
+    " !\"#$%&'()*+,-./0123456789:;<=>?@ABCDEFGHIJKLMNOPQRSTUVWXYZ[\\]^_";
+
+/* State of the baud rate negotiation in progress */
+static struct
+{
+    enum baud_state state;
+    int old_rate;               /* Rate to fall back to */
+    int new_rate;               /* Rate being tested */
+    bool persist;               /* Whether to save the new rate to the configuration */
+    int reply_slot;             /* Deferred reply slot of the sbr command */
+    size_t burst_len;           /* Length of the self-test burst */
+    size_t sent;                /* Number of burst bytes written so far */
+    size_t echoed;              /* Number of burst bytes echoed back correctly */
+    int64_t started_micros;     /* When the burst started */
+    uint32_t framing_errors;    /* Framing error count when the test started */
+    mgos_timer_id timer;
+} baud;
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: set_uart_baud_rate                                          *
+ *                                                                            *
+ * PURPOSE: Waits for pending output to be sent and reconfigures the UART to  *
+ *          a new baud rate, keeping every other setting                      *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT  TYPE    I/O DESCRIPTION                                          *
+ * --------- ------- --- -----------                                          *
+ * baud_rate int      I  The new baud rate                                    *
+ *                                                                            *
+ * RETURNS: true if the UART was reconfigured                                 *
+ *                                                                            *
+ *****************************************************************************/
+static bool set_uart_baud_rate(int baud_rate)
+{
+    struct mgos_uart_config ucfg;
+    if (!mgos_uart_config_get(UART_NO, &ucfg))
+    {
+        return false;
+    }
+    ulwi_txq_flush(); /* Everything queued must go out at the old rate */
+    ucfg.baud_rate = baud_rate;
+    if (!mgos_uart_configure(UART_NO, &ucfg))
+    {
+        return false;
+    }
+    mgos_uart_set_rx_enabled(UART_NO, true);
+    return true;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: baud_fallback                                               *
+ *                                                                            *
+ * PURPOSE: Abandons the negotiation, returns to the old baud rate and sends  *
+ *          the deferred U reply of the sbr command at that rate unless the   *
+ *          result was already sent, followed by the events held back during  *
+ *          the self-test                                                     *
+ *                                                                            *
+ * ARGUMENTS: none                                                            *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+static void baud_fallback(void)
+{
+    LOG(LL_WARN, ("Baud rate %d failed, falling back to %d", baud.new_rate, baud.old_rate));
+    mgos_clear_timer(baud.timer);
+    baud.timer = MGOS_INVALID_TIMER_ID;
+    baud.state = BAUD_IDLE;
+    set_uart_baud_rate(baud.old_rate);
+    ulwi_reply_complete(baud.reply_slot, FRAME_CRLF, "U", 1);
+    ulwi_event_release();
+}
+
+/* Writes as much of the self-test burst as the UART can take, the rest is
+   written as the dispatcher runs again with room to transmit */
+static void send_burst(void)
+{
+    size_t avail = mgos_uart_write_avail(UART_NO);
+    while (baud.sent < baud.burst_len && avail > 0)
+    {
+        const size_t offset = baud.sent % BAUD_TEST_PATTERN_LEN;
+        size_t n = BAUD_TEST_PATTERN_LEN - offset;
+        n = n < avail ? n : avail;
+        n = n < baud.burst_len - baud.sent ? n : baud.burst_len - baud.sent;
+        mgos_uart_write(UART_NO, baud_test_pattern + offset, n);
+        baud.sent += n;
+        avail -= n;
+    }
+}
+
+static void baud_timeout_cb(void *arg)
+{
+    baud.timer = MGOS_INVALID_TIMER_ID;
+    baud_fallback();
+    (void)arg;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: baud_settled_cb                                             *
+ *                                                                            *
+ * PURPOSE: Switches to the new baud rate once the master has had time to do  *
+ *          the same, then starts the self-test burst for it to echo back     *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE    I/O DESCRIPTION                                           *
+ * -------- ------- --- -----------                                           *
+ * arg      void *   I  Unused                                                *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+static void baud_settled_cb(void *arg)
+{
+    baud.timer = MGOS_INVALID_TIMER_ID;
+    if (!set_uart_baud_rate(baud.new_rate))
+    {
+        baud_fallback();
+        return;
+    }
+
+    const struct mgos_uart_stats *stats = mgos_uart_get_stats(UART_NO);
+    baud.framing_errors = stats != NULL ? stats->rx_framing_errors : 0;
+    /* A burst of many patterns measures the sustained rate rather than the
+       latency of a single round trip. It bypasses the transmit queue, as it
+       is timed and must not be held back by flow control. */
+    size_t burst_len = (size_t)baud.new_rate / 10;
+    burst_len = burst_len < BAUD_TEST_BURST_MAX ? burst_len : BAUD_TEST_BURST_MAX;
+    burst_len -= burst_len % BAUD_TEST_PATTERN_LEN;
+    baud.burst_len = burst_len > BAUD_TEST_PATTERN_LEN ? burst_len : BAUD_TEST_PATTERN_LEN;
+    baud.sent = 0;
+    baud.echoed = 0;
+    baud.state = BAUD_ECHO;
+    baud.started_micros = mgos_uptime_micros();
+    send_burst();
+    baud.timer = mgos_set_timer(BAUD_TEST_TIMEOUT_MS, 0, baud_timeout_cb, NULL);
+    (void)arg;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_baud_busy                                              *
+ *                                                                            *
+ * PURPOSE: Returns whether a baud rate negotiation is in progress            *
+ *                                                                            *
+ * ARGUMENTS: none                                                            *
+ *                                                                            *
+ * RETURNS: true if a negotiation is in progress                              *
+ *                                                                            *
+ *****************************************************************************/
+bool ulwi_baud_busy(void)
+{
+    return baud.state != BAUD_IDLE;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_baud_start                                             *
+ *                                                                            *
+ * PURPOSE: Starts negotiating a new baud rate. After BAUD_SETTLE_MS the UART *
+ *          switches rate and sends the self-test burst, which the master     *
+ *          must echo back. The measured throughput and framing errors are    *
+ *          then replied at the new rate, and the rate is only kept if the    *
+ *          master acknowledges it with cbr before BAUD_TEST_TIMEOUT_MS.      *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT   TYPE    I/O DESCRIPTION                                         *
+ * ---------- ------- --- -----------                                         *
+ * baud_rate  int      I  The proposed baud rate                              *
+ * persist    bool     I  Whether to save the rate to the configuration       *
+ * reply_slot int      I  Deferred reply slot for the result of the test      *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+void ulwi_baud_start(int baud_rate, bool persist, int reply_slot)
+{
+    struct mgos_uart_config ucfg;
+    mgos_uart_config_get(UART_NO, &ucfg);
+
+    baud.state = BAUD_SETTLING;
+    baud.old_rate = ucfg.baud_rate;
+    baud.new_rate = baud_rate;
+    baud.persist = persist;
+    baud.reply_slot = reply_slot;
+    baud.timer = mgos_set_timer(BAUD_SETTLE_MS, 0, baud_settled_cb, NULL);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_baud_commit                                            *
+ *                                                                            *
+ * PURPOSE: Keeps the negotiated baud rate once the master has acknowledged   *
+ *          it, saving it to the configuration if requested, and sends the    *
+ *          events held back during the self-test                             *
+ *                                                                            *
+ * ARGUMENTS: none                                                            *
+ *                                                                            *
+ * RETURNS: true if a tested rate was waiting for acknowledgement             *
+ *                                                                            *
+ *****************************************************************************/
+bool ulwi_baud_commit(void)
+{
+    if (baud.state != BAUD_CONFIRM)
+    {
+        return false;
+    }
+    mgos_clear_timer(baud.timer);
+    baud.timer = MGOS_INVALID_TIMER_ID;
+    baud.state = BAUD_IDLE;
+
+    if (baud.persist)
+    {
+        char *msg = NULL;
+        mgos_sys_config_set_ulwi_baud_rate(baud.new_rate);
+        if (!save_cfg(&mgos_sys_config, &msg))
+        {
+            LOG(LL_ERROR, ("Failed to save baud rate: %s", msg ? msg : ""));
+        }
+        free(msg);
+    }
+    LOG(LL_INFO, ("Baud rate %d committed", baud.new_rate));
+    ulwi_event_release();
+    return true;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_baud_consume                                           *
+ *                                                                            *
+ * PURPOSE: Called by the UART dispatcher before parsing commands. While the  *
+ *          self-test is running, the rest of the burst is written as the     *
+ *          UART has room, and input is the echo of the burst and not         *
+ *          commands, so it is checked here instead. Once the whole burst is  *
+ *          echoed, the sustained bytes/s and the framing errors seen are     *
+ *          replied as <bytes/s>|<framing errors>, and the dispatcher is run  *
+ *          again for any input that arrived behind the echo.                 *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE    I/O DESCRIPTION                                           *
+ * -------- ------- --- -----------                                           *
+ * uart_no  int      I  The UART port's identification number                 *
+ *                                                                            *
+ * RETURNS: true if the input was consumed by the self-test                   *
+ *                                                                            *
+ *****************************************************************************/
+bool ulwi_baud_consume(int uart_no)
+{
+    if (baud.state == BAUD_SETTLING)
+    {
+        /* Anything sent while both sides switch rate is garbage */
+        char discard[16];
+        while (mgos_uart_read(uart_no, discard, sizeof(discard)) > 0) {}
+        return true;
+    }
+    if (baud.state != BAUD_ECHO)
+    {
+        return false;
+    }
+
+    send_burst();
+
+    /* Never read past the end of the echo, the acknowledgement may follow it */
+    char echo[16];
+    size_t len;
+    while (baud.state == BAUD_ECHO)
+    {
+        const size_t remaining = baud.burst_len - baud.echoed;
+        len = mgos_uart_read(uart_no, echo, remaining < sizeof(echo) ? remaining : sizeof(echo));
+        if (len == 0)
+        {
+            break;
+        }
+        for (size_t i = 0; i < len; i++)
+        {
+            if (echo[i] != baud_test_pattern[baud.echoed % BAUD_TEST_PATTERN_LEN])
+            {
+                baud_fallback();
+                return true;
+            }
+            baud.echoed++;
+            if (baud.echoed == baud.burst_len)
+            {
+                const int64_t elapsed = mgos_uptime_micros() - baud.started_micros;
+                const struct mgos_uart_stats *stats = mgos_uart_get_stats(uart_no);
+                const uint32_t framing_errors = stats != NULL ? stats->rx_framing_errors - baud.framing_errors : 0;
+                const unsigned long bytes_per_s = elapsed > 0 ? (unsigned long)(baud.burst_len * 1000000LL / elapsed) : 0;
+
+                char result[24];
+                const int result_len = snprintf(result, sizeof(result), "%lu%s%lu", bytes_per_s, ULWI_DELIMITER, (unsigned long)framing_errors);
+                baud.state = BAUD_CONFIRM;
+                ulwi_reply_complete(baud.reply_slot, FRAME_CRLF, result, result_len);
+                baud.reply_slot = -1; /* Answered, a later fall back is silent */
+                /* The acknowledgement may already be waiting behind the echo */
+                mgos_uart_schedule_dispatcher(uart_no, false);
+            }
+        }
+    }
+    return true;
+}
@@ -0,0 +1,47 @@
+/******************************************************************************
+ *                                                                            *
+ * NAME: baud.h                                                               *
+ *                                                                            *
+ * PURPOSE: Provides runtime baud rate negotiation with a link self-test      *
+ *                                                                            *
+ * GLOBAL VARIABLES:                                                          *
+ *                                                                            *
+ * Variable Type Description                                                  *
+ * -------- ---- -----------                                                  *
+ *                                                                            *
+ *                                                                            *
+ *****************************************************************************/
+
+#ifndef BAUD_H
+#define BAUD_H
+
+#include "mgos.h"
+
+/* Lowest and highest baud rates accepted by the sbr command */
+#define BAUD_RATE_MIN 1200
+#define BAUD_RATE_MAX 921600
+
+/* Time given to the master to switch its own UART before the self-test */
+#define BAUD_SETTLE_MS 100
+/* Time allowed for the echo and the acknowledgement before falling back */
+#define BAUD_TEST_TIMEOUT_MS 3000
+/* Length of the self-test pattern, the printable ASCII characters 0x20-0x5F */
+#define BAUD_TEST_PATTERN_LEN 64
+/* Longest self-test burst, the pattern repeated. The burst is cut down to
+   what the new rate carries in a second, but is never shorter than the pattern */
+#define BAUD_TEST_BURST_MAX 4096
+
+enum baud_state
+{
+    BAUD_IDLE,      /* No negotiation in progress */
+    BAUD_SETTLING,  /* Waiting for the master to switch before changing rate */
+    BAUD_ECHO,      /* Self-test pattern sent at the new rate, waiting for its echo */
+    BAUD_CONFIRM    /* Self-test passed, waiting for the master to acknowledge */
+};
+
+bool ulwi_baud_busy(void);
+void ulwi_baud_start(int baud_rate, bool persist, int reply_slot);
+bool ulwi_baud_commit(void);
+bool ulwi_baud_consume(int uart_no);
+
+#endif
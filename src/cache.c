@@ -0,0 +1,204 @@
+#include "cache.h"
+
+/* A cached response. The key and the content share one allocation. */
+struct cache_entry
+{
+    char *key;                  /* NULL if the entry is free, followed by the content */
+    size_t size;                /* Bytes of the key, its terminator and the content */
+    int status;                 /* HTTP status of the response */
+    const char *content;
+    size_t len;                 /* Length of the content */
+    int64_t expires;            /* Uptime after which the entry is stale */
+    int64_t last_used;          /* When the entry was last stored or read */
+};
+
+static struct cache_entry cache[HTTP_CACHE_ENTRIES];
+static size_t cache_bytes;
+static struct ulwi_cache_stats cache_stats;
+
+/* Frees an entry */
+static void drop(struct cache_entry *entry)
+{
+    cache_bytes -= entry->size;
+    free(entry->key);
+    memset(entry, 0, sizeof(*entry));
+}
+
+/* Returns the entry of a key, or NULL */
+static struct cache_entry *find(const char *key)
+{
+    for (size_t i = 0; i < HTTP_CACHE_ENTRIES; i++)
+    {
+        if (cache[i].key != NULL && strcmp(cache[i].key, key) == 0)
+        {
+            return &cache[i];
+        }
+    }
+    return NULL;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_cache_lookup                                           *
+ *                                                                            *
+ * PURPOSE: Finds the cached response of a request, dropping it if it is      *
+ *          stale. The content stays owned by the cache and must be copied    *
+ *          before anything else is stored.                                   *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE     I/O DESCRIPTION                                          *
+ * -------- -------- --- -----------                                          *
+ * key      char *    I  The key of the request                               *
+ * status   int *     O  The HTTP status of the response                      *
+ * content  char **   O  The content of the response                          *
+ * len      size_t *  O  The length of the content                            *
+ *                                                                            *
+ * RETURNS: true if the response was cached and fresh                         *
+ *                                                                            *
+ *****************************************************************************/
+bool ulwi_cache_lookup(const char *key, int *status, const char **content, size_t *len)
+{
+    const int64_t now = mgos_uptime_micros();
+    struct cache_entry *entry = find(key);
+    if (entry != NULL && now > entry->expires)
+    {
+        drop(entry);
+        entry = NULL;
+    }
+    if (entry == NULL)
+    {
+        cache_stats.misses++;
+        return false;
+    }
+    entry->last_used = now;
+    *status = entry->status;
+    *content = entry->content;
+    *len = entry->len;
+    cache_stats.hits++;
+    return true;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_cache_store                                            *
+ *                                                                            *
+ * PURPOSE: Caches the response of a request, replacing any older response to *
+ *          it. Stale entries are dropped first to make room, then the least  *
+ *          recently used, until both an entry and HTTP_CACHE_BYTES are free. *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE          I/O DESCRIPTION                                     *
+ * -------- ------------- --- -----------                                     *
+ * key      char *         I  The key of the request                          *
+ * status   int            I  The HTTP status of the response                 *
+ * content  char *         I  The content of the response                     *
+ * len      size_t         I  The length of the content                       *
+ * ttl      uint32_t       I  Seconds to keep the response for                *
+ *                                                                            *
+ * RETURNS: none, a response that can never fit is not cached                 *
+ *                                                                            *
+ *****************************************************************************/
+void ulwi_cache_store(const char *key, int status, const char *content, size_t len, uint32_t ttl)
+{
+    const size_t key_len = strlen(key);
+    const size_t size = key_len + 1 + len;
+    struct cache_entry *entry = find(key);
+    if (entry != NULL)
+    {
+        drop(entry);
+    }
+    if (size > HTTP_CACHE_BYTES)
+    {
+        return;
+    }
+
+    const int64_t now = mgos_uptime_micros();
+    for (size_t i = 0; i < HTTP_CACHE_ENTRIES; i++)
+    {
+        if (cache[i].key != NULL && now > cache[i].expires)
+        {
+            drop(&cache[i]);
+        }
+    }
+    for (;;)
+    {
+        struct cache_entry *free_entry = NULL;
+        struct cache_entry *oldest = NULL;
+        for (size_t i = 0; i < HTTP_CACHE_ENTRIES; i++)
+        {
+            if (cache[i].key == NULL)
+            {
+                free_entry = &cache[i];
+            }
+            else if (oldest == NULL || cache[i].last_used < oldest->last_used)
+            {
+                oldest = &cache[i];
+            }
+        }
+        if (free_entry != NULL && cache_bytes + size <= HTTP_CACHE_BYTES)
+        {
+            entry = free_entry;
+            break;
+        }
+        drop(oldest);
+    }
+
+    char *block = malloc(size);
+    if (block == NULL)
+    {
+        return;
+    }
+    memcpy(block, key, key_len + 1);
+    memcpy(block + key_len + 1, content, len);
+    entry->key = block;
+    entry->size = size;
+    entry->status = status;
+    entry->content = block + key_len + 1;
+    entry->len = len;
+    entry->expires = now + (int64_t)ttl * 1000000;
+    entry->last_used = now;
+    cache_bytes += size;
+}
+
+/* Counts a miss that was coalesced onto an identical request in flight */
+void ulwi_cache_count_coalesced(void)
+{
+    cache_stats.coalesced++;
+}
+
+/* Drops every cached response */
+void ulwi_cache_flush(void)
+{
+    for (size_t i = 0; i < HTTP_CACHE_ENTRIES; i++)
+    {
+        if (cache[i].key != NULL)
+        {
+            drop(&cache[i]);
+        }
+    }
+}
+
+/* Returns the number of responses cached, including stale ones */
+size_t ulwi_cache_entries(void)
+{
+    size_t entries = 0;
+    for (size_t i = 0; i < HTTP_CACHE_ENTRIES; i++)
+    {
+        if (cache[i].key != NULL) entries++;
+    }
+    return entries;
+}
+
+/* Returns the number of bytes used by the cached keys and content */
+size_t ulwi_cache_bytes(void)
+{
+    return cache_bytes;
+}
+
+/* Returns the hit, miss and coalescing counters of the cache */
+const struct ulwi_cache_stats *ulwi_cache_get_stats(void)
+{
+    return &cache_stats;
+}
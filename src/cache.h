@@ -0,0 +1,48 @@
+/******************************************************************************
+ *                                                                            *
+ * NAME: cache.h                                                              *
+ *                                                                            *
+ * PURPOSE: Provides a cache of complete HTTP responses keyed by request      *
+ *                                                                            *
+ * GLOBAL VARIABLES:                                                          *
+ *                                                                            *
+ * Variable Type Description                                                  *
+ * -------- ---- -----------                                                  *
+ *                                                                            *
+ *                                                                            *
+ *****************************************************************************/
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "mgos.h"
+
+/* Responses kept, the least recently used is replaced */
+#ifndef HTTP_CACHE_ENTRIES
+#define HTTP_CACHE_ENTRIES 4
+#endif
+/* Bytes of keys and content kept by all entries together */
+#ifndef HTTP_CACHE_BYTES
+#define HTTP_CACHE_BYTES 4096
+#endif
+/* Longest time a response is kept, in seconds */
+#define HTTP_CACHE_TTL_MAX 86400
+/* Longest key, a request with a longer URL is never cached */
+#define HTTP_CACHE_KEY_MAX 288
+
+struct ulwi_cache_stats
+{
+    uint32_t hits;      /* Requests completed from the cache */
+    uint32_t misses;    /* Cacheable requests that were not in the cache */
+    uint32_t coalesced; /* Misses that waited for an identical request in flight */
+};
+
+bool ulwi_cache_lookup(const char *key, int *status, const char **content, size_t *len);
+void ulwi_cache_store(const char *key, int status, const char *content, size_t len, uint32_t ttl);
+void ulwi_cache_count_coalesced(void);
+void ulwi_cache_flush(void);
+size_t ulwi_cache_entries(void);
+size_t ulwi_cache_bytes(void);
+const struct ulwi_cache_stats *ulwi_cache_get_stats(void);
+
+#endif
@@ -1,6 +1,8 @@
 #include "common.h"
 #include "constants.h"
+#include "http.h"
 
+#if ULWI_BENCHMARK
 /******************************************************************************
  *                                                                            *
  * FUNCTION NAME: split_parameter_string                                      *
@@ -8,7 +10,8 @@
  * PURPOSE: Split up a string (char array) into multiple strings, using the   *
  *          ASCII Unit Separator character as a delimiter, returning a        *
  *          multidimensional array and actual number of parameters present    *
- *          in that array.                                                    *
+ *          in that array. Superseded by ulwi_split_params, only kept as the  *
+ *          baseline of the tokenizer benchmark.                              *
  *                                                                            *
  * ARGUMENTS:                                                                 *
  *                                                                            *
@@ -39,24 +42,25 @@ int split_parameter_string(char *target_str, const int max_params, const int max
 
     return max_param_counter;
 }
+#endif /* ULWI_BENCHMARK */
 
 /******************************************************************************
  *                                                                            *
  * FUNCTION NAME: repl_str                                                    *
  *                                                                            *
- * PURPOSE: Replaces strings in a C char array string. 					      *
+ * PURPOSE: Replaces strings in a C char array string.                        *
  *                                                                            *
  * ARGUMENTS:                                                                 *
  *                                                                            *
  * ARGUMENT TYPE    I/O DESCRIPTION                                           *
  * -------- ------- --- -----------                                           *
  * str      char *   I  The string to replace strings for. This function will *
- * 						not alter this string.								  *
- * from     char *   I  The target string to replace from.					  *
- * to       char *   I  The target string to replace to.					  *
+ *                      not alter this string.                                *
+ * from     char *   I  The target string to replace from.                    *
+ * to       char *   I  The target string to replace to.                      *
  *                                                                            *
  * RETURNS: a char pointer that refers to a string. Needs to be manually      *
- * 			freed by calling free() on the pointer.                           *
+ *          freed by calling free() on the pointer.                           *
  *                                                                            *
  *****************************************************************************/
 char *repl_str(const char *str, const char *from, const char *to)
@@ -146,22 +150,22 @@ end_repl_str:
  *                                                                            *
  * FUNCTION NAME: ulwi_validate_strlen                                        *
  *                                                                            *
- * PURPOSE: Validates a string length by checking the raw length integer	  *
- * 			against an upper and a lower boundary. 							  *
- * 																			  *
- * NOTE: `mg_str` lengths typically do not include null termination			  *
+ * PURPOSE: Validates a string length by checking the raw length integer      *
+ *          against an upper and a lower boundary.                            *
+ *                                                                            *
+ * NOTE: `mg_str` lengths typically do not include null termination           *
  *                                                                            *
  * ARGUMENTS:                                                                 *
  *                                                                            *
  * ARGUMENT TYPE    I/O DESCRIPTION                                           *
  * -------- ------- --- -----------                                           *
- * length   size_t   I  The length of the string to check					  *
- * lower    size_t   I  Lower boundary (inclusive) length to check for		  *
- * upper    size_t   I  Upper boundary (inclusive) length to check for		  *
+ * length   size_t   I  The length of the string to check                     *
+ * lower    size_t   I  Lower boundary (inclusive) length to check for        *
+ * upper    size_t   I  Upper boundary (inclusive) length to check for        *
  *                                                                            *
- * RETURNS: a str_len_state enum that indicates that the string is within	  *
- * 			acceptable margins (STRING_OK), too short (STRING_SHORT) or too	  *
- * 			long (STRING_LONG).												  *
+ * RETURNS: a str_len_state enum that indicates that the string is within     *
+ *          acceptable margins (STRING_OK), too short (STRING_SHORT) or too   *
+ *          long (STRING_LONG).                                               *
  *                                                                            *
  *****************************************************************************/
 enum str_len_state ulwi_validate_strlen(size_t length, size_t lower, size_t upper)
@@ -180,27 +184,28 @@ enum str_len_state ulwi_validate_strlen(size_t length, size_t lower, size_t uppe
 	}
 }
 
+#if ULWI_BENCHMARK
 /******************************************************************************
  *                                                                            *
  * FUNCTION NAME: ulwi_cpy_params_only                                        *
  *                                                                            *
- * PURPOSE: Almost functionally identical to strlcpy, except that it only	  *
- * 			copies the parameters from a command to a C style string. This	  *
- * 			function accomplishes this by advancing the source pointer by 4   *
- * 			indices (which covers the first 3 characters of the command + a	  *
- * 			space), and by reducing the maximum length by 3 (from the 4		  *
- * 			deducted characters minus 1 null termination char). This function *
- * 			performs NO bounds checking and it must be done elsewhere!		  *
+ * PURPOSE: Almost functionally identical to strlcpy, except that it only     *
+ *          copies the parameters from a command to a C style string. This    *
+ *          function accomplishes this by advancing the source pointer by 4   *
+ *          indices (which covers the first 3 characters of the command + a   *
+ *          space), and by reducing the maximum length by 3 (from the 4       *
+ *          deducted characters minus 1 null termination char). This function *
+ *          performs NO bounds checking and it must be done elsewhere!        *
  *                                                                            *
  * ARGUMENTS:                                                                 *
  *                                                                            *
  * ARGUMENT TYPE    I/O DESCRIPTION                                           *
  * -------- ------- --- -----------                                           *
- * target   char *   O  The target to copy the string _to_					  *
- * source   char *   I  The place to copy the string _from_				      *
+ * target   char *   O  The target to copy the string _to_                    *
+ * source   char *   I  The place to copy the string _from_                   *
  * len      size_t   I  The length of the entire command, not just the params *
  *                                                                            *
- * RETURNS: a boolean indicating whether the copy was successful			  *
+ * RETURNS: a boolean indicating whether the copy was successful              *
  *                                                                            *
  *****************************************************************************/
 bool ulwi_cpy_params_only(char *target, const char *source, const size_t len)
@@ -213,3 +218,527 @@ bool ulwi_cpy_params_only(char *target, const char *source, const size_t len)
 	strlcpy(target, source + 4, len - 3); /* length is reduced by 3 because of the command length of 3 */
 	return true;
 }
+#endif /* ULWI_BENCHMARK */
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_decode_opcode                                          *
+ *                                                                            *
+ * PURPOSE: Decodes the 3 character mnemonic at the start of a command line   *
+ *          into its opcode. The mnemonic is packed into one integer and      *
+ *          resolved by a single switch, which the compiler turns into a      *
+ *          jump table or binary search, so every command costs the same      *
+ *          regardless of where it sits in the instruction set.               *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE    I/O DESCRIPTION                                           *
+ * -------- ------- --- -----------                                           *
+ * line     mg_str   I  The full command line, without the line ending        *
+ *                                                                            *
+ * RETURNS: the ulwi_opcode of the command, or OPCODE_INVALID if the line is  *
+ *          too short or the mnemonic is unknown                              *
+ *                                                                            *
+ *****************************************************************************/
+enum ulwi_opcode ulwi_decode_opcode(struct mg_str line)
+{
+	if (line.len < 3)
+	{
+		return OPCODE_INVALID;
+	}
+
+	switch (ULWI_OPCODE_PACK(line.p[0], line.p[1], line.p[2]))
+	{
+	case ULWI_OPCODE_PACK('n', 'o', 'p'): return OPCODE_NOP;
+	case ULWI_OPCODE_PACK('v', 'e', 'r'): return OPCODE_VER;
+	case ULWI_OPCODE_PACK('r', 's', 't'): return OPCODE_RST;
+	case ULWI_OPCODE_PACK('o', 't', 'a'): return OPCODE_OTA;
+	case ULWI_OPCODE_PACK('l', 'a', 'p'): return OPCODE_LAP;
+	case ULWI_OPCODE_PACK('c', 'a', 'p'): return OPCODE_CAP;
+	case ULWI_OPCODE_PACK('s', 'a', 'p'): return OPCODE_SAP;
+	case ULWI_OPCODE_PACK('d', 'a', 'p'): return OPCODE_DAP;
+	case ULWI_OPCODE_PACK('g', 'i', 'p'): return OPCODE_GIP;
+	case ULWI_OPCODE_PACK('i', 'h', 'r'): return OPCODE_IHR;
+	case ULWI_OPCODE_PACK('p', 'h', 'r'): return OPCODE_PHR;
+	case ULWI_OPCODE_PACK('h', 'h', 'r'): return OPCODE_HHR;
+	case ULWI_OPCODE_PACK('t', 'h', 'r'): return OPCODE_THR;
+	case ULWI_OPCODE_PACK('s', 'h', 'r'): return OPCODE_SHR;
+	case ULWI_OPCODE_PACK('g', 'h', 'r'): return OPCODE_GHR;
+	case ULWI_OPCODE_PACK('d', 'h', 'r'): return OPCODE_DHR;
+	case ULWI_OPCODE_PACK('m', 'c', 'g'): return OPCODE_MCG;
+	case ULWI_OPCODE_PACK('m', 'i', 'c'): return OPCODE_MIC;
+	case ULWI_OPCODE_PACK('m', 's', 'b'): return OPCODE_MSB;
+	case ULWI_OPCODE_PACK('m', 'u', 's'): return OPCODE_MUS;
+	case ULWI_OPCODE_PACK('m', 'n', 'd'): return OPCODE_MND;
+	case ULWI_OPCODE_PACK('m', 'g', 's'): return OPCODE_MGS;
+	case ULWI_OPCODE_PACK('m', 'p', 'b'): return OPCODE_MPB;
+	case ULWI_OPCODE_PACK('b', 'f', 'm'): return OPCODE_BFM;
+	case ULWI_OPCODE_PACK('p', 'i', 'p'): return OPCODE_PIP;
+	case ULWI_OPCODE_PACK('s', 'b', 'r'): return OPCODE_SBR;
+	case ULWI_OPCODE_PACK('c', 'b', 'r'): return OPCODE_CBR;
+	case ULWI_OPCODE_PACK('s', 'f', 'c'): return OPCODE_SFC;
+	case ULWI_OPCODE_PACK('s', 'e', 'n'): return OPCODE_SEN;
+	case ULWI_OPCODE_PACK('g', 's', 'r'): return OPCODE_GSR;
+	case ULWI_OPCODE_PACK('r', 'h', 'r'): return OPCODE_RHR;
+	case ULWI_OPCODE_PACK('q', 'h', 'r'): return OPCODE_QHR;
+	case ULWI_OPCODE_PACK('j', 'h', 'r'): return OPCODE_JHR;
+	case ULWI_OPCODE_PACK('h', 'p', 's'): return OPCODE_HPS;
+	case ULWI_OPCODE_PACK('t', 's', 'c'): return OPCODE_TSC;
+	case ULWI_OPCODE_PACK('d', 'n', 's'): return OPCODE_DNS;
+	case ULWI_OPCODE_PACK('c', 'h', 'r'): return OPCODE_CHR;
+	case ULWI_OPCODE_PACK('s', 'j', 'b'): return OPCODE_SJB;
+	case ULWI_OPCODE_PACK('g', 'j', 'b'): return OPCODE_GJB;
+	case ULWI_OPCODE_PACK('h', 'c', 'r'): return OPCODE_HCR;
+	case ULWI_OPCODE_PACK('a', 'h', 'r'): return OPCODE_AHR;
+	case ULWI_OPCODE_PACK('l', 's', 't'): return OPCODE_LST;
+	default: return OPCODE_INVALID;
+	}
+}
+
+/* Parameters of the binary frame being dispatched, which are separated by
+   null terminators that may also occur within them, so their lengths are
+   kept here for the cursor */
+static struct
+{
+	const char *p;						/* Start of the parameters, NULL outside of a frame */
+	uint32_t lens[ULWI_FRAME_PARAMS_MAX];	/* Length of every parameter */
+	size_t count;						/* Number of parameters */
+} framed;
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_params_unframe                                         *
+ *                                                                            *
+ * PURPOSE: Turns the payload of a binary frame, in which every parameter is  *
+ *          led by its length as a varint, into the layout of text mode with  *
+ *          a null terminator in place of each delimiter. The lengths are     *
+ *          kept for the parameter cursor, so parameters may hold any byte    *
+ *          including 0x1F, and the payload is as long as the same            *
+ *          parameters in text mode for the command table checks.             *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE       I/O DESCRIPTION                                        *
+ * -------- ---------- --- -----------                                        *
+ * payload  char *      IO The payload, null terminated, rewritten in place   *
+ * len      size_t *    IO The length of the payload before and after         *
+ *                                                                            *
+ * RETURNS: false if a length is malformed, overruns the payload or there are *
+ *          more than ULWI_FRAME_PARAMS_MAX parameters                        *
+ *                                                                            *
+ *****************************************************************************/
+bool ulwi_params_unframe(char *payload, size_t *len)
+{
+	size_t read = 0;
+	size_t written = 0;
+	framed.count = 0;
+	while (read < *len)
+	{
+		uint32_t param_len;
+		const int varint_len = ulwi_varint_decode((const uint8_t *)payload + read, *len - read, &param_len);
+		if (framed.count == ULWI_FRAME_PARAMS_MAX || varint_len <= 0 || param_len > *len - read - varint_len)
+		{
+			return false;
+		}
+		read += varint_len;
+		if (framed.count > 0)
+		{
+			payload[written++] = '\0';
+		}
+		/* Lengths take at least as much room as delimiters, so this only ever moves left */
+		memmove(payload + written, payload + read, param_len);
+		written += param_len;
+		read += param_len;
+		framed.lens[framed.count++] = param_len;
+	}
+	payload[written] = '\0';
+	framed.p = payload;
+	*len = written;
+	return true;
+}
+
+/* Forgets the parameters of the binary frame once it has been dispatched */
+void ulwi_params_end_frame(void)
+{
+	framed.p = NULL;
+	framed.count = 0;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_params_init                                            *
+ *                                                                            *
+ * PURPOSE: Prepares a parameter cursor over the parameters of a command,     *
+ *          which is everything after the mnemonic and its space in text      *
+ *          mode or the frame payload in binary mode. The parameters must be  *
+ *          null terminated and writable, as the parse functions below null   *
+ *          terminate every parameter in place instead of copying it.         *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE          I/O DESCRIPTION                                     *
+ * -------- ------------- --- -----------                                     *
+ * cursor   ulwi_params *  O  The cursor to initialise                        *
+ * params   mg_str         I  The parameters of the command                   *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+void ulwi_params_init(struct ulwi_params *cursor, struct mg_str params)
+{
+	cursor->end = (char *)params.p + params.len;
+	cursor->next = params.len > 0 ? (char *)params.p : NULL;
+	cursor->lens = params.p == framed.p ? framed.lens : NULL;
+	cursor->count = framed.count;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_param_str                                              *
+ *                                                                            *
+ * PURPOSE: Returns the next parameter as a slice of the command line. The    *
+ *          delimiter after the parameter is replaced by a null terminator,   *
+ *          so result.p can also be used as a C string. Unlike strtok, empty  *
+ *          parameters are preserved and the cursor holds all of the state.   *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE          I/O DESCRIPTION                                     *
+ * -------- ------------- --- -----------                                     *
+ * params   ulwi_params *  IO The parameter cursor                            *
+ * result   mg_str *       O  The parameter, pointing into the command line   *
+ *                                                                            *
+ * RETURNS: true if a parameter was available, false if all were consumed     *
+ *                                                                            *
+ *****************************************************************************/
+bool ulwi_param_str(struct ulwi_params *params, struct mg_str *result)
+{
+	if (params->next == NULL)
+	{
+		return false;
+	}
+
+	char *start = params->next;
+	if (params->lens != NULL)
+	{
+		/* Binary frame parameters are only ever split by their lengths */
+		result->p = start;
+		result->len = *params->lens++;
+		params->count--;
+		params->next = params->count > 0 ? start + result->len + 1 : NULL;
+		return true;
+	}
+
+	char *delimiter = memchr(start, ULWI_DELIMITER[0], params->end - start);
+	if (delimiter != NULL)
+	{
+		*delimiter = '\0';
+		params->next = delimiter + 1;
+	}
+	else
+	{
+		delimiter = params->end;
+		params->next = NULL;
+	}
+	result->p = start;
+	result->len = delimiter - start;
+	return true;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_split_params                                           *
+ *                                                                            *
+ * PURPOSE: Splits all parameters of a command into slices, replacing         *
+ *          split_parameter_string for commands that take a variable number   *
+ *          of parameters.                                                    *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT   TYPE     I/O DESCRIPTION                                        *
+ * ---------- -------- --- -----------                                        *
+ * params     mg_str    I  The parameters of the command                      *
+ * result     mg_str *  O  Array receiving up to max_params parameters        *
+ * max_params int       I  Size of the result array                           *
+ *                                                                            *
+ * RETURNS: the actual number of parameters in the line, which may be larger  *
+ *          than max_params, useful for bounds checking                       *
+ *                                                                            *
+ *****************************************************************************/
+int ulwi_split_params(struct mg_str params, struct mg_str *result, int max_params)
+{
+	struct ulwi_params cursor;
+	struct mg_str discard;
+	int count = 0;
+
+	ulwi_params_init(&cursor, params);
+	while (ulwi_param_str(&cursor, count < max_params ? &result[count] : &discard))
+	{
+		count++;
+	}
+	return count;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_param_char                                             *
+ *                                                                            *
+ * PURPOSE: Parses the next parameter as a single character flag, such as     *
+ *          the G/P method of ihr or the S/H/C type of ghr.                   *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE          I/O DESCRIPTION                                     *
+ * -------- ------------- --- -----------                                     *
+ * params   ulwi_params *  IO The parameter cursor                            *
+ * allowed  char *         I  The characters accepted for this flag           *
+ * result   char *         O  The parsed character                            *
+ *                                                                            *
+ * RETURNS: true if the parameter is exactly one of the allowed characters    *
+ *                                                                            *
+ *****************************************************************************/
+bool ulwi_param_char(struct ulwi_params *params, const char *allowed, char *result)
+{
+	struct mg_str token;
+	if (!ulwi_param_str(params, &token) || token.len != 1 || strchr(allowed, token.p[0]) == NULL)
+	{
+		return false;
+	}
+	*result = token.p[0];
+	return true;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_param_bool                                             *
+ *                                                                            *
+ * PURPOSE: Parses the next parameter as a T/F boolean                        *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE          I/O DESCRIPTION                                     *
+ * -------- ------------- --- -----------                                     *
+ * params   ulwi_params *  IO The parameter cursor                            *
+ * result   bool *         O  The parsed boolean                              *
+ *                                                                            *
+ * RETURNS: true if the parameter is exactly T or F                           *
+ *                                                                            *
+ *****************************************************************************/
+bool ulwi_param_bool(struct ulwi_params *params, bool *result)
+{
+	char flag;
+	if (!ulwi_param_char(params, "TF", &flag))
+	{
+		return false;
+	}
+	*result = flag == ULWI_TRUE;
+	return true;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_param_int                                              *
+ *                                                                            *
+ * PURPOSE: Parses the next parameter as a non-negative decimal integer and   *
+ *          checks it against an upper and a lower boundary.                  *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE          I/O DESCRIPTION                                     *
+ * -------- ------------- --- -----------                                     *
+ * params   ulwi_params *  IO The parameter cursor                            *
+ * lower    long           I  Lower boundary (inclusive)                      *
+ * upper    long           I  Upper boundary (inclusive)                      *
+ * result   long *         O  The parsed integer                              *
+ *                                                                            *
+ * RETURNS: true if the parameter only has digits and is within boundaries    *
+ *                                                                            *
+ *****************************************************************************/
+bool ulwi_param_int(struct ulwi_params *params, long lower, long upper, long *result)
+{
+	struct mg_str token;
+	if (!ulwi_param_str(params, &token) || token.len == 0 || token.len > 9)
+	{
+		/* Up to 9 digits can never overflow a long */
+		return false;
+	}
+
+	long value = 0;
+	for (size_t i = 0; i < token.len; i++)
+	{
+		if (!isdigit((int)token.p[i]))
+		{
+			return false;
+		}
+		value = value * 10 + (token.p[i] - '0');
+	}
+	if (value < lower || value > upper)
+	{
+		return false;
+	}
+	*result = value;
+	return true;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_param_handle                                           *
+ *                                                                            *
+ * PURPOSE: Parses the next parameter as a HTTP request handle                *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE          I/O DESCRIPTION                                     *
+ * -------- ------------- --- -----------                                     *
+ * params   ulwi_params *  IO The parameter cursor                            *
+ * handle   int *          O  The parsed handle                               *
+ *                                                                            *
+ * RETURNS: true if the parameter is a handle within the handle table         *
+ *                                                                            *
+ *****************************************************************************/
+bool ulwi_param_handle(struct ulwi_params *params, int *handle)
+{
+	long value;
+	if (!ulwi_param_int(params, 0, ulwi_http_handles() - 1, &value))
+	{
+		return false;
+	}
+	*handle = (int)value;
+	return true;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_varint_encode                                          *
+ *                                                                            *
+ * PURPOSE: Encodes an unsigned integer as a little endian base 128 varint,   *
+ *          7 bits per byte with the top bit set on every byte but the last.  *
+ *          Lengths below 128 therefore cost a single byte on the wire.       *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE       I/O DESCRIPTION                                        *
+ * -------- ---------- --- -----------                                        *
+ * value    uint32_t    I  The integer to encode                              *
+ * out      uint8_t *   O  At least ULWI_VARINT_MAX bytes to encode into      *
+ *                                                                            *
+ * RETURNS: the number of bytes written to out                                *
+ *                                                                            *
+ *****************************************************************************/
+size_t ulwi_varint_encode(uint32_t value, uint8_t *out)
+{
+	size_t i = 0;
+	while (value >= 0x80)
+	{
+		out[i++] = (uint8_t)(value | 0x80);
+		value >>= 7;
+	}
+	out[i++] = (uint8_t)value;
+	return i;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_varint_decode                                          *
+ *                                                                            *
+ * PURPOSE: Decodes a varint written by ulwi_varint_encode                    *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE       I/O DESCRIPTION                                        *
+ * -------- ---------- --- -----------                                        *
+ * data     uint8_t *   I  The bytes to decode from                           *
+ * len      size_t      I  The number of bytes available in data              *
+ * value    uint32_t *  O  The decoded integer                                *
+ *                                                                            *
+ * RETURNS: the number of bytes consumed, 0 if more bytes are needed or -1 if *
+ *          the varint is longer than ULWI_VARINT_MAX bytes                   *
+ *                                                                            *
+ *****************************************************************************/
+int ulwi_varint_decode(const uint8_t *data, size_t len, uint32_t *value)
+{
+	uint32_t result = 0;
+	for (size_t i = 0; i < ULWI_VARINT_MAX; i++)
+	{
+		if (i >= len)
+		{
+			return 0;
+		}
+		result |= (uint32_t)(data[i] & 0x7F) << (7 * i);
+		if ((data[i] & 0x80) == 0)
+		{
+			*value = result;
+			return i + 1;
+		}
+	}
+	return -1;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_crc16                                                  *
+ *                                                                            *
+ * PURPOSE: Updates a CRC-16/CCITT-FALSE (polynomial 0x1021) over a block of  *
+ *          data. Computed bitwise as frames are short and flash is scarce.   *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE       I/O DESCRIPTION                                        *
+ * -------- ---------- --- -----------                                        *
+ * crc      uint16_t    I  The running CRC, ULWI_CRC16_INIT for a new one     *
+ * data     uint8_t *   I  The data to add to the CRC                         *
+ * len      size_t      I  Length of the data                                 *
+ *                                                                            *
+ * RETURNS: the updated CRC                                                   *
+ *                                                                            *
+ *****************************************************************************/
+uint16_t ulwi_crc16(uint16_t crc, const uint8_t *data, size_t len)
+{
+	for (size_t i = 0; i < len; i++)
+	{
+		crc ^= (uint16_t)data[i] << 8;
+		for (int bit = 0; bit < 8; bit++)
+		{
+			crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+		}
+	}
+	return crc;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_server_key                                             *
+ *                                                                            *
+ * PURPOSE: Builds the scheme://host:port key of the server of a URL, with    *
+ *          the default port of the scheme filled in, which identifies the    *
+ *          server in the connection pool and the TLS session cache           *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE    I/O DESCRIPTION                                           *
+ * -------- ------- --- -----------                                           *
+ * url      char *   I  The URL of the request                                *
+ * key      char *   O  Buffer of ULWI_SERVER_KEY_MAX bytes for the key       *
+ *                                                                            *
+ * RETURNS: false if the URL cannot be parsed, has user info or the key is    *
+ *          too long                                                          *
+ *                                                                            *
+ *****************************************************************************/
+bool ulwi_server_key(const char *url, char *key)
+{
+	struct mg_str scheme, user_info, host, path, query, fragment;
+	unsigned int port = 0;
+	if (mg_parse_uri(mg_mk_str(url), &scheme, &user_info, &host, &port, &path, &query, &fragment) != 0 ||
+		user_info.len > 0)
+	{
+		return false;
+	}
+	const bool https = mg_vcmp(&scheme, "https") == 0;
+	if (port == 0)
+	{
+		port = https ? 443 : 80;
+	}
+	const int len = snprintf(key, ULWI_SERVER_KEY_MAX, "%s://%.*s:%u", https ? "https" : "http",
+							 (int)host.len, host.p, port);
+	return len > 0 && len < ULWI_SERVER_KEY_MAX;
+}
@@ -17,6 +17,15 @@
 
 #include "mgos.h"
 
+#include "constants.h"
+
+/* Set to 1 through cdefs in mos.yml to log the cost of decoding and splitting
+   commands at boot. Kept apart from DEVELOPMENT as it delays every boot and
+   needs about 600 bytes of stack. */
+#ifndef ULWI_BENCHMARK
+#define ULWI_BENCHMARK 0
+#endif
+
 enum boolean
 {
     ULWI_TRUE = 'T',
@@ -30,9 +39,63 @@ enum str_len_state
     STRING_LONG
 };
 
+/* Cursor over the 0x1F delimited parameters of a command. Parameters are
+   returned as slices of the receive buffer itself, which is null terminated
+   in place at every delimiter, so no parameter is ever copied */
+struct ulwi_params
+{
+    char *next;             /* Start of the next parameter, NULL once all are consumed */
+    char *end;              /* End of the parameter string (the null terminator) */
+    const uint32_t *lens;   /* Lengths of the remaining parameters of a binary frame, NULL in text mode */
+    size_t count;           /* Number of lengths left in lens */
+};
+
+/* Most parameters a binary frame can carry */
+#define ULWI_FRAME_PARAMS_MAX 8
+
+#if ULWI_BENCHMARK
 int split_parameter_string(char *target_str, const int max_params, const int max_param_len, char result[max_params][max_param_len]);
+bool ulwi_cpy_params_only(char *target, const char *source, const size_t len);
+#endif
 char *repl_str(const char *str, const char *from, const char *to);
 enum str_len_state ulwi_validate_strlen(size_t length, size_t lower, size_t upper);
-bool ulwi_cpy_params_only(char *target, const char *source, const size_t len);
+enum ulwi_opcode ulwi_decode_opcode(struct mg_str line);
+
+bool ulwi_params_unframe(char *payload, size_t *len);
+void ulwi_params_end_frame(void);
+void ulwi_params_init(struct ulwi_params *cursor, struct mg_str params);
+int ulwi_split_params(struct mg_str params, struct mg_str *result, int max_params);
+bool ulwi_param_str(struct ulwi_params *params, struct mg_str *result);
+bool ulwi_param_char(struct ulwi_params *params, const char *allowed, char *result);
+bool ulwi_param_bool(struct ulwi_params *params, bool *result);
+bool ulwi_param_int(struct ulwi_params *params, long lower, long upper, long *result);
+bool ulwi_param_handle(struct ulwi_params *params, int *handle);
+
+/* Longest varint needed to encode a 32 bit length */
+#define ULWI_VARINT_MAX 5
+/* Initial value of the CRC-16/CCITT-FALSE used by binary frames */
+#define ULWI_CRC16_INIT 0xFFFF
+
+size_t ulwi_varint_encode(uint32_t value, uint8_t *out);
+int ulwi_varint_decode(const uint8_t *data, size_t len, uint32_t *value);
+uint16_t ulwi_crc16(uint16_t crc, const uint8_t *data, size_t len);
+
+/* Longest scheme://host:port key of a server, longer host names are not keyed */
+#define ULWI_SERVER_KEY_MAX 72
+
+bool ulwi_server_key(const char *url, char *key);
+
+/* Reads a free running counter for benchmarking. On the ESP8266 this is the
+   Xtensa CCOUNT cycle counter, elsewhere it falls back to microseconds */
+static inline uint32_t ulwi_cycle_count(void)
+{
+#if defined(__XTENSA__)
+    uint32_t ccount;
+    __asm__ __volatile__("rsr %0, ccount" : "=a"(ccount));
+    return ccount;
+#else
+    return (uint32_t)mgos_uptime_micros();
+#endif
+}
 
 #endif
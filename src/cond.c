@@ -0,0 +1,302 @@
+#include "mbedtls/sha256.h"
+
+#include "cond.h"
+
+/* Validators of a response kept in flash. The content is in a file of its
+   own, named after the index of the entry. Keys are only kept as a quick
+   hash and their SHA-256 digest, as a URL with its headers is longer than
+   the validators themselves. The digest is compared before the content is
+   served, so the content kept for another request never is. */
+struct cond_entry
+{
+    uint32_t key_hash;                  /* FNV-1a hash of the key, 0 if the entry is free */
+    uint8_t key_digest[32];             /* SHA-256 digest of the key, checked once key_hash matches */
+    uint32_t key_len;                   /* Length of the key */
+    uint32_t stamp;                     /* Order in which entries were stored, the lowest is replaced */
+    int32_t status;                     /* HTTP status of the response */
+    char etag[HTTP_ETAG_MAX + 1];       /* ETag of the response, empty if it had none */
+    char last_modified[HTTP_DATE_MAX + 1];  /* Last-Modified of the response, empty if it had none */
+};
+
+static struct cond_entry entries[HTTP_COND_ENTRIES];
+static uint32_t last_stamp;    /* Stamp of the entry stored last */
+
+/* Path of the file that the content of an entry is kept in */
+static void content_path(size_t entry, char *path, size_t size)
+{
+    snprintf(path, size, "ulwi_cond%u.dat", (unsigned)entry);
+}
+
+/* Path of the file that the content of a handle is copied to while it arrives */
+static void copy_path(int handle, char *path, size_t size)
+{
+    snprintf(path, size, "ulwi_cond_h%d.tmp", handle);
+}
+
+/* Returns the hash of a key, never 0 */
+static uint32_t key_hash(const char *key)
+{
+    uint32_t hash = 2166136261u;
+    for (const char *p = key; *p != '\0'; p++)
+    {
+        hash = (hash ^ (uint8_t)*p) * 16777619u;
+    }
+    return hash != 0 ? hash : 1;
+}
+
+/* Returns the entry of a key, or NULL */
+static struct cond_entry *find(const char *key)
+{
+    const uint32_t hash = key_hash(key);
+    const uint32_t len = (uint32_t)strlen(key);
+    uint8_t digest[32];
+    bool digested = false;
+    for (size_t i = 0; i < HTTP_COND_ENTRIES; i++)
+    {
+        if (entries[i].key_hash != hash || entries[i].key_len != len)
+        {
+            continue;
+        }
+        if (!digested)
+        {
+            mbedtls_sha256_ret((const unsigned char *)key, len, digest, 0);
+            digested = true;
+        }
+        if (memcmp(entries[i].key_digest, digest, sizeof(digest)) == 0)
+        {
+            return &entries[i];
+        }
+    }
+    return NULL;
+}
+
+/* Writes the entries to HTTP_COND_FILE, led by their size so that a file
+   written by a build with other limits or another layout is not loaded */
+static void save(void)
+{
+    FILE *file = fopen(HTTP_COND_FILE, "wb");
+    if (file == NULL)
+    {
+        LOG(LL_ERROR, ("Cannot create %s", HTTP_COND_FILE));
+        return;
+    }
+    const uint32_t size = sizeof(entries);
+    fwrite(&size, sizeof(size), 1, file);
+    fwrite(entries, sizeof(entries[0]), HTTP_COND_ENTRIES, file);
+    fclose(file);
+}
+
+/* Frees an entry and deletes its content */
+static void drop(struct cond_entry *entry)
+{
+    char path[24];
+    content_path(entry - entries, path, sizeof(path));
+    remove(path);
+    memset(entry, 0, sizeof(*entry));
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_cond_init                                              *
+ *                                                                            *
+ * PURPOSE: Loads the validators kept in flash. Entries whose content file is *
+ *          missing are dropped, as a 304 could not be answered for them.     *
+ *                                                                            *
+ * ARGUMENTS: none                                                            *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+void ulwi_cond_init(void)
+{
+    FILE *file = fopen(HTTP_COND_FILE, "rb");
+    if (file == NULL)
+    {
+        return;
+    }
+    uint32_t size = 0;
+    if (fread(&size, sizeof(size), 1, file) != 1 || size != sizeof(entries) ||
+        fread(entries, sizeof(entries[0]), HTTP_COND_ENTRIES, file) != HTTP_COND_ENTRIES)
+    {
+        memset(entries, 0, sizeof(entries));
+    }
+    fclose(file);
+
+    for (size_t i = 0; i < HTTP_COND_ENTRIES; i++)
+    {
+        struct cond_entry *entry = &entries[i];
+        if (entry->key_hash == 0)
+        {
+            continue;
+        }
+        entry->etag[HTTP_ETAG_MAX] = '\0';
+        entry->last_modified[HTTP_DATE_MAX] = '\0';
+        char path[24];
+        content_path(i, path, sizeof(path));
+        FILE *content = fopen(path, "rb");
+        if (content == NULL)
+        {
+            drop(entry);
+            continue;
+        }
+        fclose(content);
+        if (entry->stamp > last_stamp)
+        {
+            last_stamp = entry->stamp;
+        }
+    }
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_cond_headers                                           *
+ *                                                                            *
+ * PURPOSE: Builds the If-None-Match and If-Modified-Since headers that make  *
+ *          a GET conditional on the response kept for it                     *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE    I/O DESCRIPTION                                           *
+ * -------- ------- --- -----------                                           *
+ * key      char *   I  The key of the request                                *
+ * headers  char *   O  The headers, HTTP_COND_HEADERS_MAX bytes              *
+ *                                                                            *
+ * RETURNS: false if no response is kept for the request                      *
+ *                                                                            *
+ *****************************************************************************/
+bool ulwi_cond_headers(const char *key, char *headers)
+{
+    const struct cond_entry *entry = find(key);
+    if (entry == NULL)
+    {
+        return false;
+    }
+    size_t len = 0;
+    headers[0] = '\0';
+    if (entry->etag[0] != '\0')
+    {
+        len += snprintf(headers + len, HTTP_COND_HEADERS_MAX - len, "If-None-Match: %s\r\n", entry->etag);
+    }
+    if (entry->last_modified[0] != '\0')
+    {
+        snprintf(headers + len, HTTP_COND_HEADERS_MAX - len, "If-Modified-Since: %s\r\n", entry->last_modified);
+    }
+    return true;
+}
+
+/* Opens the content kept for a request, or returns NULL if there is none */
+FILE *ulwi_cond_open(const char *key, int *status)
+{
+    const struct cond_entry *entry = find(key);
+    if (entry == NULL)
+    {
+        return NULL;
+    }
+    char path[24];
+    content_path(entry - entries, path, sizeof(path));
+    *status = entry->status;
+    return fopen(path, "rb");
+}
+
+/* Creates the file that the content of a handle is copied to while it arrives */
+FILE *ulwi_cond_begin(int handle)
+{
+    char path[24];
+    copy_path(handle, path, sizeof(path));
+    return fopen(path, "wb");
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_cond_commit                                            *
+ *                                                                            *
+ * PURPOSE: Keeps the validators of a complete response and the content that  *
+ *          was copied while it arrived, replacing what was kept for the      *
+ *          request before, or else the least recently stored entry           *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT      TYPE    I/O DESCRIPTION                                      *
+ * ------------- ------- --- -----------                                      *
+ * handle        int      I  The handle the content was copied for            *
+ * file          FILE *   I  The copy of the content, which is closed         *
+ * key           char *   I  The key of the request                           *
+ * status        int      I  The HTTP status of the response                  *
+ * etag          mg_str   I  The ETag of the response, may be empty           *
+ * last_modified mg_str   I  The Last-Modified of the response, may be empty  *
+ *                                                                            *
+ * RETURNS: none, validators too long to keep are dropped with the content    *
+ *                                                                            *
+ *****************************************************************************/
+void ulwi_cond_commit(int handle, FILE *file, const char *key, int status, struct mg_str etag, struct mg_str last_modified)
+{
+    fclose(file);
+    char copy[24];
+    copy_path(handle, copy, sizeof(copy));
+    struct cond_entry *entry = find(key);
+    if (entry != NULL)
+    {
+        drop(entry);
+    }
+    if (etag.len > HTTP_ETAG_MAX || last_modified.len > HTTP_DATE_MAX)
+    {
+        remove(copy);
+        save();
+        return;
+    }
+
+    entry = &entries[0];
+    for (size_t i = 0; i < HTTP_COND_ENTRIES && entry->key_hash != 0; i++)
+    {
+        if (entries[i].key_hash == 0 || entries[i].stamp < entry->stamp)
+        {
+            entry = &entries[i];
+        }
+    }
+    if (entry->key_hash != 0)
+    {
+        drop(entry);
+    }
+    char path[24];
+    content_path(entry - entries, path, sizeof(path));
+    if (rename(copy, path) != 0)
+    {
+        LOG(LL_ERROR, ("Cannot keep %s as %s", copy, path));
+        remove(copy);
+        save();
+        return;
+    }
+    entry->key_hash = key_hash(key);
+    entry->key_len = (uint32_t)strlen(key);
+    mbedtls_sha256_ret((const unsigned char *)key, entry->key_len, entry->key_digest, 0);
+    entry->stamp = ++last_stamp;
+    entry->status = status;
+    memcpy(entry->etag, etag.p, etag.len);
+    entry->etag[etag.len] = '\0';
+    memcpy(entry->last_modified, last_modified.p, last_modified.len);
+    entry->last_modified[last_modified.len] = '\0';
+    save();
+}
+
+/* Closes and deletes the copy of the content of a handle, file may be NULL */
+void ulwi_cond_discard(int handle, FILE *file)
+{
+    char path[24];
+    if (file != NULL)
+    {
+        fclose(file);
+    }
+    copy_path(handle, path, sizeof(path));
+    remove(path);
+}
+
+/* Drops what is kept for a request whose response no longer has validators */
+void ulwi_cond_forget(const char *key)
+{
+    struct cond_entry *entry = find(key);
+    if (entry != NULL)
+    {
+        drop(entry);
+        save();
+    }
+}
@@ -0,0 +1,46 @@
+/******************************************************************************
+ *                                                                            *
+ * NAME: cond.h                                                               *
+ *                                                                            *
+ * PURPOSE: Provides conditional GETs, keeping the ETag and Last-Modified     *
+ *          validators of responses in flash along with their content, so     *
+ *          that a 304 can be answered with the content kept before           *
+ *                                                                            *
+ * GLOBAL VARIABLES:                                                          *
+ *                                                                            *
+ * Variable Type Description                                                  *
+ * -------- ---- -----------                                                  *
+ *                                                                            *
+ *                                                                            *
+ *****************************************************************************/
+
+#ifndef COND_H
+#define COND_H
+
+#include "mgos.h"
+
+/* Requests whose validators and content are kept, the least recently stored is replaced */
+#ifndef HTTP_COND_ENTRIES
+#define HTTP_COND_ENTRIES 4
+#endif
+/* Longest content kept in flash for an entry, longer responses are not revalidated */
+#ifndef HTTP_COND_CONTENT_MAX
+#define HTTP_COND_CONTENT_MAX 8192
+#endif
+/* Longest ETag and Last-Modified values, responses with longer ones are not kept */
+#define HTTP_ETAG_MAX 64
+#define HTTP_DATE_MAX 32
+/* Room for the If-None-Match and If-Modified-Since headers of an entry */
+#define HTTP_COND_HEADERS_MAX (HTTP_ETAG_MAX + HTTP_DATE_MAX + 40)
+/* File in flash that the validators are kept in across resets */
+#define HTTP_COND_FILE "ulwi_cond.dat"
+
+void ulwi_cond_init(void);
+bool ulwi_cond_headers(const char *key, char *headers);
+FILE *ulwi_cond_open(const char *key, int *status);
+FILE *ulwi_cond_begin(int handle);
+void ulwi_cond_commit(int handle, FILE *file, const char *key, int status, struct mg_str etag, struct mg_str last_modified);
+void ulwi_cond_discard(int handle, FILE *file);
+void ulwi_cond_forget(const char *key);
+
+#endif
@@ -23,7 +23,43 @@
 
 #define UART_NO 0
 
-#define HTTP_HANDLES_MAX 3
+/* Most HTTP handles that ulwi.http_handles can configure, which keeps handles
+   to HTTP_HANDLE_DIGITS digits */
+#define HTTP_HANDLES_LIMIT 256
+#define HTTP_HANDLE_DIGITS 3
+
+/* Maximum number of command lines handled per UART dispatcher invocation
+   before yielding back to the Mongoose event loop */
+#define UART_DISPATCH_LINE_BUDGET 4
+
+/* Maximum number of commands in pipelining mode whose replies are still
+   outstanding because they complete asynchronously */
+#define PIPELINE_WINDOW 4
+
+/* Size of the UART receive buffers, overridable at build time through the
+   cdefs section of mos.yml */
+#ifndef UART_RX_BUF_SIZE
+#define UART_RX_BUF_SIZE 1024
+#endif
+
+/* Longest command line accepted, excluding CRLF. Longer lines are answered
+   with "long" and discarded up to their CRLF */
+#ifndef UART_RX_LINE_MAX
+#define UART_RX_LINE_MAX 384
+#endif
+
+#if UART_RX_LINE_MAX + 2 > UART_RX_BUF_SIZE
+#error "UART_RX_BUF_SIZE must hold at least one line of UART_RX_LINE_MAX bytes and its CRLF"
+#endif
+
+/* Bits of the first byte of the status register replied by gsr */
+#define STATUS_WIFI_N 0x00          /* Bits 0-1: state of the access point as replied by sap */
+#define STATUS_WIFI_P 0x01
+#define STATUS_WIFI_S 0x02
+#define STATUS_WIFI_U 0x03
+#define STATUS_MQTT_CONNECTED 0x04  /* MQTT is connected, as replied by mic */
+#define STATUS_HTTP_DONE 0x08       /* At least one HTTP request succeeded or failed */
+#define STATUS_MQTT_NEW_DATA 0x10   /* At least one MQTT subscription has new data */
 
 static const char ULWI_DELIMITER[] = "\x1f";
 static const char XON_1[] = "\x11";
@@ -31,37 +67,60 @@ static const char XOFF_1[] = "\x13";
 static const char XON_2[] = "\x12";
 static const char XOFF_2[] = "\x14";
 
-/* General operations commands */
-static const struct mg_str COMMAND_NOP = MG_MK_STR("nop");
-static const struct mg_str COMMAND_VER = MG_MK_STR("ver");
-static const struct mg_str COMMAND_RST = MG_MK_STR("rst");
-static const struct mg_str COMMAND_OTA = MG_MK_STR("ota");
-
-/* Access Point commands */
-static const struct mg_str COMMAND_LAP = MG_MK_STR("lap");
-static const struct mg_str COMMAND_CAP = MG_MK_STR("cap");
-static const struct mg_str COMMAND_SAP = MG_MK_STR("sap");
-static const struct mg_str COMMAND_DAP = MG_MK_STR("dap");
-
-/* IP related commands */
-static const struct mg_str COMMAND_GIP = MG_MK_STR("gip");
-
-/* HTTP Request commands */
-static const struct mg_str COMMAND_IHR = MG_MK_STR("ihr");
-static const struct mg_str COMMAND_PHR = MG_MK_STR("phr");
-static const struct mg_str COMMAND_HHR = MG_MK_STR("hhr");
-static const struct mg_str COMMAND_THR = MG_MK_STR("thr");
-static const struct mg_str COMMAND_SHR = MG_MK_STR("shr");
-static const struct mg_str COMMAND_GHR = MG_MK_STR("ghr");
-static const struct mg_str COMMAND_DHR = MG_MK_STR("dhr");
+/* Packs the 3 characters of a command mnemonic into a single integer so that
+   commands can be decoded with one switch statement */
+#define ULWI_OPCODE_PACK(a, b, c) \
+    ((uint32_t)(uint8_t)(a) | ((uint32_t)(uint8_t)(b) << 8) | ((uint32_t)(uint8_t)(c) << 16))
 
-/* MQTT commands */
-static const struct mg_str COMMAND_MCG = MG_MK_STR("mcg");
-static const struct mg_str COMMAND_MIC = MG_MK_STR("mic");
-static const struct mg_str COMMAND_MSB = MG_MK_STR("msb");
-static const struct mg_str COMMAND_MUS = MG_MK_STR("mus");
-static const struct mg_str COMMAND_MND = MG_MK_STR("mnd");
-static const struct mg_str COMMAND_MGS = MG_MK_STR("mgs");
-static const struct mg_str COMMAND_MPB = MG_MK_STR("mpb");
+/* Index of every command in the command table. These values are also the
+   opcodes of the binary frame mode, so new commands must only ever be added
+   at the end to keep existing opcodes stable */
+enum ulwi_opcode
+{
+    OPCODE_NOP,
+    OPCODE_VER,
+    OPCODE_RST,
+    OPCODE_OTA,
+    OPCODE_LAP,
+    OPCODE_CAP,
+    OPCODE_SAP,
+    OPCODE_DAP,
+    OPCODE_GIP,
+    OPCODE_IHR,
+    OPCODE_PHR,
+    OPCODE_HHR,
+    OPCODE_THR,
+    OPCODE_SHR,
+    OPCODE_GHR,
+    OPCODE_DHR,
+    OPCODE_MCG,
+    OPCODE_MIC,
+    OPCODE_MSB,
+    OPCODE_MUS,
+    OPCODE_MND,
+    OPCODE_MGS,
+    OPCODE_MPB,
+    OPCODE_BFM,
+    OPCODE_PIP,
+    OPCODE_SBR,
+    OPCODE_CBR,
+    OPCODE_SFC,
+    OPCODE_SEN,
+    OPCODE_GSR,
+    OPCODE_RHR,
+    OPCODE_QHR,
+    OPCODE_JHR,
+    OPCODE_HPS,
+    OPCODE_TSC,
+    OPCODE_DNS,
+    OPCODE_CHR,
+    OPCODE_SJB,
+    OPCODE_GJB,
+    OPCODE_HCR,
+    OPCODE_AHR,
+    OPCODE_LST,
+    OPCODE_COUNT,   /* Number of commands, must stay after the last command */
+    OPCODE_INVALID = OPCODE_COUNT
+};
 
 #endif
@@ -0,0 +1,294 @@
+#include "dns.h"
+
+/* A resolved host name */
+struct dns_entry
+{
+    char host[DNS_HOST_MAX];    /* Empty if the entry is free */
+    uint32_t address;           /* IPv4 address in network byte order */
+    int64_t expires;            /* Uptime after which the address must be resolved again */
+    int64_t last_used;          /* When the entry was last stored or read */
+};
+
+/* A lookup waiting for the resolver */
+struct dns_pending
+{
+    bool busy;                  /* Whether the resolver has not answered yet */
+    char host[DNS_HOST_MAX];
+    ulwi_dns_cb cb;             /* NULL once cancelled */
+    void *arg;
+};
+
+static struct dns_entry cache[DNS_CACHE_MAX];
+static struct dns_pending pending[DNS_PENDING_MAX];
+static struct ulwi_dns_stats dns_stats;
+
+/* Parses a dotted IPv4 address, which never needs to be resolved */
+static bool parse_ipv4(const char *host, uint32_t *address)
+{
+    unsigned int octets[4];
+    char end;
+    if (sscanf(host, "%u.%u.%u.%u%c", &octets[0], &octets[1], &octets[2], &octets[3], &end) != 4 ||
+        octets[0] > 255 || octets[1] > 255 || octets[2] > 255 || octets[3] > 255)
+    {
+        return false;
+    }
+    uint8_t *bytes = (uint8_t *)address;
+    for (size_t i = 0; i < 4; i++)
+    {
+        bytes[i] = (uint8_t)octets[i];
+    }
+    return true;
+}
+
+static struct dns_entry *find_entry(const char *host)
+{
+    for (size_t i = 0; i < DNS_CACHE_MAX; i++)
+    {
+        if (cache[i].host[0] != '\0' && strcmp(cache[i].host, host) == 0)
+        {
+            return &cache[i];
+        }
+    }
+    return NULL;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: store_entry                                                 *
+ *                                                                            *
+ * PURPOSE: Caches the address of a host for its TTL, clamped to the          *
+ *          ulwi.dns_ttl_min and ulwi.dns_ttl_max settings                    *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE     I/O DESCRIPTION                                          *
+ * -------- -------- --- -----------                                          *
+ * host     char *    I  The host name                                        *
+ * address  uint32_t  I  Its address in network byte order                    *
+ * ttl      int       I  TTL of the DNS record in seconds                     *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+static void store_entry(const char *host, uint32_t address, int ttl)
+{
+    const int ttl_min = mgos_sys_config_get_ulwi_dns_ttl_min();
+    const int ttl_max = mgos_sys_config_get_ulwi_dns_ttl_max();
+    if (ttl < ttl_min) ttl = ttl_min;
+    if (ttl > ttl_max) ttl = ttl_max;
+    if (ttl <= 0)
+    {
+        return;
+    }
+
+    const int64_t now = mgos_uptime_micros();
+    struct dns_entry *entry = find_entry(host);
+    if (entry == NULL)
+    {
+        /* A free entry, otherwise the least recently used one */
+        entry = &cache[0];
+        for (size_t i = 0; i < DNS_CACHE_MAX; i++)
+        {
+            if (cache[i].host[0] == '\0')
+            {
+                entry = &cache[i];
+                break;
+            }
+            if (cache[i].last_used < entry->last_used)
+            {
+                entry = &cache[i];
+            }
+        }
+        strcpy(entry->host, host);
+    }
+    entry->address = address;
+    entry->expires = now + (int64_t)ttl * 1000000;
+    entry->last_used = now;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: resolve_cb                                                  *
+ *                                                                            *
+ * PURPOSE: Receives the answer of the resolver to a lookup, caches the first *
+ *          A record and passes it on to whoever asked for it                 *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE             I/O DESCRIPTION                                  *
+ * -------- ---------------- --- -----------                                  *
+ * msg      mg_dns_message *  I  The answer, NULL if there is none            *
+ * data     void *            I  The pending lookup                           *
+ * err      mg_resolve_err    I  Whether the lookup succeeded                 *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+static void resolve_cb(struct mg_dns_message *msg, void *data, enum mg_resolve_err err)
+{
+    struct dns_pending *lookup = (struct dns_pending *)data;
+    bool ok = false;
+    uint32_t address = 0;
+    if (err == MG_RESOLVE_OK && msg != NULL)
+    {
+        for (int i = 0; i < msg->num_answers; i++)
+        {
+            struct mg_dns_resource_record *rr = &msg->answers[i];
+            if (rr->rtype == MG_DNS_A_RECORD &&
+                mg_dns_parse_record_data(msg, rr, &address, sizeof(address)) == 0)
+            {
+                store_entry(lookup->host, address, rr->ttl);
+                ok = true;
+                break;
+            }
+        }
+    }
+    if (!ok)
+    {
+        LOG(LL_ERROR, ("Cannot resolve %s: %d", lookup->host, (int)err));
+    }
+
+    lookup->busy = false;
+    if (lookup->cb != NULL)
+    {
+        lookup->cb(ok, address, lookup->arg);
+    }
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_dns_lookup                                             *
+ *                                                                            *
+ * PURPOSE: Looks a host name up in the cache only                            *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE       I/O DESCRIPTION                                        *
+ * -------- ---------- --- -----------                                        *
+ * host     char *      I  The host name, or a dotted IPv4 address            *
+ * address  uint32_t *  O  Its address in network byte order                  *
+ *                                                                            *
+ * RETURNS: false if the host is not cached or its TTL has passed             *
+ *                                                                            *
+ *****************************************************************************/
+bool ulwi_dns_lookup(const char *host, uint32_t *address)
+{
+    if (parse_ipv4(host, address))
+    {
+        return true;
+    }
+    struct dns_entry *entry = find_entry(host);
+    const int64_t now = mgos_uptime_micros();
+    if (entry == NULL || now > entry->expires)
+    {
+        dns_stats.misses++;
+        return false;
+    }
+    dns_stats.hits++;
+    entry->last_used = now;
+    *address = entry->address;
+    return true;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_dns_resolve                                            *
+ *                                                                            *
+ * PURPOSE: Resolves a host name, from the cache if possible. A cached or     *
+ *          literal address is passed to the callback before this function    *
+ *          returns, others once the DNS server answers.                      *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE        I/O DESCRIPTION                                       *
+ * -------- ----------- --- -----------                                       *
+ * host     char *       I  The host name, or a dotted IPv4 address           *
+ * cb       ulwi_dns_cb  I  Called with the address                           *
+ * arg      void *       I  Passed to the callback, and to ulwi_dns_cancel    *
+ *                                                                            *
+ * RETURNS: false if the lookup could not be started, in which case the       *
+ *          callback is never called                                          *
+ *                                                                            *
+ *****************************************************************************/
+bool ulwi_dns_resolve(const char *host, ulwi_dns_cb cb, void *arg)
+{
+    uint32_t address;
+    if (ulwi_dns_lookup(host, &address))
+    {
+        cb(true, address, arg);
+        return true;
+    }
+    if (strlen(host) >= DNS_HOST_MAX)
+    {
+        return false;
+    }
+
+    struct dns_pending *lookup = NULL;
+    for (size_t i = 0; i < DNS_PENDING_MAX && lookup == NULL; i++)
+    {
+        if (!pending[i].busy)
+        {
+            lookup = &pending[i];
+        }
+    }
+    if (lookup == NULL)
+    {
+        LOG(LL_ERROR, ("Too many DNS lookups in progress"));
+        return false;
+    }
+    strcpy(lookup->host, host);
+    lookup->cb = cb;
+    lookup->arg = arg;
+    lookup->busy = mg_resolve_async(mgos_get_mgr(), host, MG_DNS_A_RECORD, resolve_cb, lookup) == 0;
+    return lookup->busy;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_dns_cancel                                             *
+ *                                                                            *
+ * PURPOSE: Stops lookups from calling back, for when their argument is freed *
+ *          or reused. The lookups still complete and are still cached.       *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE    I/O DESCRIPTION                                           *
+ * -------- ------- --- -----------                                           *
+ * arg      void *   I  The argument given to ulwi_dns_resolve                *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+void ulwi_dns_cancel(void *arg)
+{
+    for (size_t i = 0; i < DNS_PENDING_MAX; i++)
+    {
+        if (pending[i].busy && pending[i].arg == arg)
+        {
+            pending[i].cb = NULL;
+        }
+    }
+}
+
+/* Drops every cached host name */
+void ulwi_dns_flush(void)
+{
+    memset(cache, 0, sizeof(cache));
+}
+
+/* Returns the number of host names cached, including expired ones */
+size_t ulwi_dns_entries(void)
+{
+    size_t entries = 0;
+    for (size_t i = 0; i < DNS_CACHE_MAX; i++)
+    {
+        if (cache[i].host[0] != '\0') entries++;
+    }
+    return entries;
+}
+
+/* Returns the hit and miss counters of the cache */
+const struct ulwi_dns_stats *ulwi_dns_get_stats(void)
+{
+    return &dns_stats;
+}
@@ -0,0 +1,50 @@
+/******************************************************************************
+ *                                                                            *
+ * NAME: dns.h                                                                *
+ *                                                                            *
+ * PURPOSE: Provides a cache of resolved host names for HTTP and MQTT         *
+ *                                                                            *
+ * GLOBAL VARIABLES:                                                          *
+ *                                                                            *
+ * Variable Type Description                                                  *
+ * -------- ---- -----------                                                  *
+ *                                                                            *
+ *                                                                            *
+ *****************************************************************************/
+
+#ifndef DNS_H
+#define DNS_H
+
+#include "mgos.h"
+
+#include "constants.h"
+
+/* Host names kept, the least recently used is replaced */
+#ifndef DNS_CACHE_MAX
+#define DNS_CACHE_MAX 4
+#endif
+/* Longest host name cached, longer names are always resolved */
+#define DNS_HOST_MAX 64
+/* Lookups that can wait for the resolver at once, further ones fail */
+#ifndef DNS_PENDING_MAX
+#define DNS_PENDING_MAX 4
+#endif
+
+/* Called with the IPv4 address of a host in network byte order, or with
+   ok false if it could not be resolved */
+typedef void (*ulwi_dns_cb)(bool ok, uint32_t address, void *arg);
+
+struct ulwi_dns_stats
+{
+    uint32_t hits;      /* Lookups answered from the cache */
+    uint32_t misses;    /* Lookups that went to the DNS server */
+};
+
+bool ulwi_dns_lookup(const char *host, uint32_t *address);
+bool ulwi_dns_resolve(const char *host, ulwi_dns_cb cb, void *arg);
+void ulwi_dns_cancel(void *arg);
+void ulwi_dns_flush(void);
+size_t ulwi_dns_entries(void);
+const struct ulwi_dns_stats *ulwi_dns_get_stats(void);
+
+#endif
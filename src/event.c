@@ -0,0 +1,275 @@
+#include "event.h"
+#include "baud.h"
+#include "constants.h"
+#include "reply.h"
+
+/* Event classes the master has enabled, none by default so that masters
+   which only poll never see an event */
+static uint8_t event_mask = 0;
+
+/* Events held back while the baud rate self-test is running, as the master
+   is echoing the test pattern and would echo them too. Only the latest state
+   of each handle, subscription and job is kept. */
+static struct
+{
+    uint32_t http[HTTP_HANDLES_LIMIT / 32];         /* Handles that finished */
+    uint32_t http_failed[HTTP_HANDLES_LIMIT / 32];  /* Of those, the ones that failed */
+    struct mbuf mqtt;                               /* Topics with new data, each NUL terminated */
+    uint8_t jobs;                                   /* Jobs whose result changed */
+    char wifi;                                      /* Latest Wi-Fi state, '\0' if unchanged */
+} held;
+
+/* Adds a topic to the held MQTT events unless it is already there */
+static void hold_mqtt(const char *topic)
+{
+    const size_t len = strlen(topic) + 1;
+    for (size_t i = 0; i < held.mqtt.len; i += strlen(held.mqtt.buf + i) + 1)
+    {
+        if (strcmp(held.mqtt.buf + i, topic) == 0)
+        {
+            return;
+        }
+    }
+    mbuf_append(&held.mqtt, topic, len);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: send_event                                                  *
+ *                                                                            *
+ * PURPOSE: Sends an event if its class is enabled                            *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE         I/O DESCRIPTION                                      *
+ * -------- ------------ --- -----------                                      *
+ * class    event_class   I  The class of the event                           *
+ * data     char *        I  The event, starting with its class letter        *
+ * len      size_t        I  Length of the event                              *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+static void send_event(enum event_class class, const char *data, size_t len)
+{
+    if ((event_mask & class) == 0)
+    {
+        return;
+    }
+    ulwi_reply_event(data, len);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_event_set_mask                                         *
+ *                                                                            *
+ * PURPOSE: Enables the given event classes and disables all others           *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE    I/O DESCRIPTION                                           *
+ * -------- ------- --- -----------                                           *
+ * mask     uint8_t  I  Bitwise OR of the event_class values to enable        *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+void ulwi_event_set_mask(uint8_t mask)
+{
+    event_mask = mask;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_event_mask                                             *
+ *                                                                            *
+ * PURPOSE: Returns the event classes that are enabled                        *
+ *                                                                            *
+ * ARGUMENTS: none                                                            *
+ *                                                                            *
+ * RETURNS: bitwise OR of the enabled event_class values                      *
+ *                                                                            *
+ *****************************************************************************/
+uint8_t ulwi_event_mask(void)
+{
+    return event_mask;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_event_http                                             *
+ *                                                                            *
+ * PURPOSE: Notifies the master that a HTTP request has finished, with the    *
+ *          same S or U that shr would now reply with                         *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE             I/O DESCRIPTION                                  *
+ * -------- ---------------- --- -----------                                  *
+ * handle   int               I  The handle of the request                    *
+ * progress request_progress  I  SUCCESS or FAILED                            *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+void ulwi_event_http(int handle, enum request_progress progress)
+{
+    if (ulwi_baud_busy())
+    {
+        if ((event_mask & EVENT_HTTP) != 0 && handle >= 0 && handle < HTTP_HANDLES_LIMIT)
+        {
+            const uint32_t bit = 1u << (handle % 32);
+            held.http[handle / 32] |= bit;
+            if (progress == FAILED)
+            {
+                held.http_failed[handle / 32] |= bit;
+            }
+            else
+            {
+                held.http_failed[handle / 32] &= ~bit;
+            }
+        }
+        return;
+    }
+    char event[16];
+    const int len = snprintf(event, sizeof(event), "H%d%s%c", handle, ULWI_DELIMITER, (char)progress);
+    send_event(EVENT_HTTP, event, len);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_event_mqtt                                             *
+ *                                                                            *
+ * PURPOSE: Notifies the master that new data arrived on a subscription,      *
+ *          which can then be read with mgs                                   *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE    I/O DESCRIPTION                                           *
+ * -------- ------- --- -----------                                           *
+ * topic    char *   I  The topic of the subscription                         *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+void ulwi_event_mqtt(const char *topic)
+{
+    if ((event_mask & EVENT_MQTT) == 0)
+    {
+        return;
+    }
+    if (ulwi_baud_busy())
+    {
+        hold_mqtt(topic);
+        return;
+    }
+    struct mbuf event;
+    mbuf_init(&event, 0);
+    mbuf_append(&event, "M", 1);
+    mbuf_append(&event, topic, strlen(topic));
+    send_event(EVENT_MQTT, event.buf, event.len);
+    mbuf_free(&event);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_event_wifi                                             *
+ *                                                                            *
+ * PURPOSE: Notifies the master that the Wi-Fi station changed state, with    *
+ *          the same N, P or S that sap would now reply with                  *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE    I/O DESCRIPTION                                           *
+ * -------- ------- --- -----------                                           *
+ * state    char     I  The new state                                         *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+void ulwi_event_wifi(char state)
+{
+    if (ulwi_baud_busy())
+    {
+        held.wifi = state;
+        return;
+    }
+    const char event[2] = { 'W', state };
+    send_event(EVENT_WIFI, event, sizeof(event));
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_event_job                                              *
+ *                                                                            *
+ * PURPOSE: Notifies the master that the result of a scheduled job changed,   *
+ *          which can then be read with gjb                                   *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE    I/O DESCRIPTION                                           *
+ * -------- ------- --- -----------                                           *
+ * job      int      I  The job                                               *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+void ulwi_event_job(int job)
+{
+    if (ulwi_baud_busy())
+    {
+        held.jobs |= 1u << job;
+        return;
+    }
+    char event[8];
+    const int len = snprintf(event, sizeof(event), "J%d", job);
+    send_event(EVENT_JOB, event, len);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_event_release                                          *
+ *                                                                            *
+ * PURPOSE: Sends the events held back while the baud rate self-test was      *
+ *          running, once it has ended. Classes disabled in the meantime are  *
+ *          dropped.                                                          *
+ *                                                                            *
+ * ARGUMENTS: none                                                            *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+void ulwi_event_release(void)
+{
+    for (int handle = 0; handle < HTTP_HANDLES_LIMIT; handle++)
+    {
+        const uint32_t bit = 1u << (handle % 32);
+        if ((held.http[handle / 32] & bit) != 0)
+        {
+            ulwi_event_http(handle, (held.http_failed[handle / 32] & bit) != 0 ? FAILED : SUCCESS);
+        }
+    }
+    memset(held.http, 0, sizeof(held.http));
+    memset(held.http_failed, 0, sizeof(held.http_failed));
+
+    for (size_t i = 0; i < held.mqtt.len; i += strlen(held.mqtt.buf + i) + 1)
+    {
+        ulwi_event_mqtt(held.mqtt.buf + i);
+    }
+    mbuf_free(&held.mqtt);
+
+    if (held.wifi != '\0')
+    {
+        ulwi_event_wifi(held.wifi);
+        held.wifi = '\0';
+    }
+
+    for (int job = 0; held.jobs != 0; job++)
+    {
+        if ((held.jobs & (1u << job)) != 0)
+        {
+            held.jobs &= ~(1u << job);
+            ulwi_event_job(job);
+        }
+    }
+}
@@ -0,0 +1,39 @@
+/******************************************************************************
+ *                                                                            *
+ * NAME: event.h                                                              *
+ *                                                                            *
+ * PURPOSE: Provides unsolicited event notifications to the master            *
+ *                                                                            *
+ * GLOBAL VARIABLES:                                                          *
+ *                                                                            *
+ * Variable Type Description                                                  *
+ * -------- ---- -----------                                                  *
+ *                                                                            *
+ *                                                                            *
+ *****************************************************************************/
+
+#ifndef EVENT_H
+#define EVENT_H
+
+#include "mgos.h"
+
+#include "http.h"
+
+/* Classes of events, which are enabled individually by the sen command */
+enum event_class
+{
+    EVENT_HTTP = 1 << 0,    /* A HTTP request succeeded or failed */
+    EVENT_MQTT = 1 << 1,    /* New data arrived on an MQTT subscription */
+    EVENT_WIFI = 1 << 2,    /* The Wi-Fi station changed state */
+    EVENT_JOB = 1 << 3      /* The result of a scheduled job changed */
+};
+
+void ulwi_event_set_mask(uint8_t mask);
+uint8_t ulwi_event_mask(void);
+void ulwi_event_http(int handle, enum request_progress progress);
+void ulwi_event_mqtt(const char *topic);
+void ulwi_event_wifi(char state);
+void ulwi_event_job(int job);
+void ulwi_event_release(void);
+
+#endif
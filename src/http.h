@@ -3,9 +3,62 @@
 
 #include "mgos.h"
 
+#include "json.h"
+
 #define HTTP_TX_CONTENT_MAX 256
 #define HTTP_RX_CONTENT_MAX 512
 
+/* Smallest body budget that ulwi.http_body_max can configure */
+#define HTTP_BODY_MIN 64
+/* Deleted handles kept allocated for the next ihr, the rest are freed */
+#define HTTP_SLOT_SPARES 1
+/* Requests that may be connecting or receiving at once, the rest wait in the queue */
+#ifndef HTTP_ACTIVE_MAX
+#define HTTP_ACTIVE_MAX 2
+#endif
+/* Requests that can wait for their turn, thr fails once the queue is full. In
+   pipelining mode each request also holds a deferred reply until it finishes,
+   so no more than PIPELINE_WINDOW are in progress at once */
+#ifndef HTTP_QUEUE_MAX
+#define HTTP_QUEUE_MAX 8
+#endif
+/* Highest priority thr accepts, higher priorities leave the queue first */
+#define HTTP_PRIORITY_MAX 9
+/* Estimated heap used by a new connection, and its largest single allocation,
+   which must both be free before the connection is opened */
+#ifndef HTTP_COST_HTTP
+#define HTTP_COST_HTTP 4096
+#endif
+#ifndef HTTP_COST_HTTPS
+#define HTTP_COST_HTTPS 20480
+#endif
+#define HTTP_BLOCK_HTTP 1536
+#define HTTP_BLOCK_HTTPS 5120
+/* How often a queue held back by the heap checks it again */
+#define HTTP_QUEUE_RETRY_MS 250
+/* cache_ttl of a request that is cached for as long as its Cache-Control allows */
+#define HTTP_CACHE_AUTO -1
+/* Headers that chr can capture per handle, and the longest name of one */
+#define HTTP_CAPTURE_MAX 4
+#define HTTP_CAPTURE_NAME_MAX 32
+/* Bytes of a response that hold the captured header names and values */
+#ifndef HTTP_CAPTURE_SIZE
+#define HTTP_CAPTURE_SIZE 128
+#endif
+/* Bytes of the arena of a handle that hold the URL, POST body and headers */
+#ifndef HTTP_ARENA_STRINGS
+#define HTTP_ARENA_STRINGS 1024
+#endif
+/* Bytes of a chunked POST body held for a handle, before the request is
+   sent or while its connection is still sending earlier chunks */
+#ifndef HTTP_TX_WINDOW
+#define HTTP_TX_WINDOW 1024
+#endif
+/* Largest content kept in flash, the rest is dropped */
+#ifndef HTTP_SPILL_MAX
+#define HTTP_SPILL_MAX 32768
+#endif
+
 enum http_data
 {
     POST_FIELD, /* Specifies parameters for a HTTP request. Only applicable for the PHR command */
@@ -14,6 +67,13 @@ enum http_data
     STATE       /* Retrieves the current state of the HTTP data. Only applicable for the GHR command */
 };
 
+enum http_append
+{
+    APPEND_DONE,        /* The chunk was appended to the body */
+    APPEND_FULL,        /* The window is full, the chunk must be appended again once it drains */
+    APPEND_INVALID      /* The handle does not exist, is not a POST, or its body has ended */
+};
+
 enum request_progress
 {
     NONEXISTENT = 'N',    /* This request does not exist at all */
@@ -22,32 +82,89 @@ enum request_progress
     FAILED = 'U'          /* Failed (unsuccessful) request */
 };
 
+/* Bump allocator over memory allocated with a handle, released all at once */
+struct http_arena
+{
+    char *base;     /* First byte of the arena */
+    size_t size;    /* Number of bytes in the arena */
+    size_t used;    /* Number of bytes handed out from the start */
+};
+
 struct http_request
 {
     char method;                        /* HTTP method of the request, G for GET, P for POST and so on */
     struct mg_str url;
     struct mg_str post_field;   /* Parameters of the request, usually part of the URL */
     struct mg_str headers;      /* HTTP headers of the request */
+    struct json_extractor *json;    /* Paths declared by jhr, NULL if the content is kept whole */
+    struct mg_str captures;     /* Names of the headers declared by chr, delimited with NULs */
+    int32_t cache_ttl;          /* Seconds a response is cached for, 0 to bypass the cache, HTTP_CACHE_AUTO by default */
+    bool chunked;               /* Whether the POST body is appended with ahr and sent with chunked encoding */
+    bool upload_ended;          /* Whether ahr appended the last chunk of the body */
+    struct mbuf upload;         /* Chunks appended before the request was sent, up to HTTP_TX_WINDOW bytes */
+    struct http_arena arena;    /* Holds the URL, POST body and headers */
 };
 
 struct http_response
 {
     int status;                         /* Request status (may be HTTP status as well) */
     enum request_progress progress;     /* Current progress of the request */
-    int64_t written;                    /* Number of bytes written */
-    char headers[HTTP_RX_CONTENT_MAX];  /* Headers of the HTTP response */
-    struct mbuf content_buffer;
-    struct mg_str content;
+    int64_t written;                    /* Number of bytes of content received */
+    int64_t released;                   /* Number of bytes of content read and released by rhr */
+    int64_t content_length;             /* Content-Length of the response, -1 if unknown */
+    bool streaming;                     /* Whether content is held back for rhr instead of spilled past the body budget */
+    FILE *spill_file;                   /* File the content is being written to once spilled, while in progress */
+    int64_t spilled;                    /* Number of bytes of content in the spill file, 0 if content is in RAM */
+    struct mg_connection *connection;   /* Connection of the request while it is in progress */
+    bool admitted;                      /* Whether the request left the queue and counts against HTTP_ACTIVE_MAX */
+    uint8_t priority;                   /* Priority of the request in the queue */
+    struct http_response *leader;       /* Identical request in flight whose result this one waits for */
+    char cache;                         /* H if completed from the cache, C from the leader, 0 if fetched */
+    bool validated;                     /* Whether the request was sent with the validators kept in flash */
+    FILE *copy_file;                    /* File the content is copied to while in progress, to keep it with its validators */
+    int64_t copied;                     /* Number of bytes of content in the copy file */
+    int32_t max_age;                    /* max-age of the Cache-Control header, 0 if the response must not be cached, -1 if not given */
+    bool reused;                        /* Whether the request was sent on a connection from the pool */
+    struct http_request *request;       /* Request while it is in progress, to retry it if a pooled connection drops */
+    int handle;                         /* Handle of the request, for event notifications */
+    int reply_slot;                     /* Deferred reply of a pipelined thr, sent when the request finishes, -1 if none */
+    uint32_t digest;                    /* ulwi_response_digest of the response once it finished */
+    uint32_t read_digest;               /* Digest of the response the master last read, kept across thr */
+    bool read;                          /* Whether the master has read a response of the handle, kept across thr */
+    struct json_extractor *json;        /* Extractor of the request that the content is fed to instead of kept */
+    char captured[HTTP_CAPTURE_SIZE];   /* Headers captured for chr, as NUL terminated names each followed by its value */
+    size_t captured_len;                /* Number of bytes used in captured, 0 until the headers arrive */
+    char *arena_body;                   /* Body budget in the arena of the handle, ulwi.http_body_max bytes */
+    char *body;                         /* Content kept in RAM, arena_body unless a stream outgrew it */
+    size_t body_len;                    /* Number of bytes of content in body */
+    size_t body_size;                   /* Number of bytes body can hold, not counting a NUL terminator */
 };
 
+bool ulwi_http_transmit(struct http_request *request, struct http_response *response);
+bool ulwi_http_start(int handle, bool streaming, uint8_t priority, int reply_slot);
+int ulwi_http_queue_position(const struct http_response *s);
 void ev_handler(struct mg_connection *nc, int ev, void *ev_data MG_UD_ARG(void *user_data));
 
-bool response_handle_readable(struct http_response * response_array, int handle);
+bool ulwi_http_init(void);
+int ulwi_http_handles(void);
+size_t ulwi_http_body_max(void);
+int ulwi_http_create(void);
+void ulwi_http_delete(int handle);
+struct http_request *ulwi_http_request(int handle);
+struct http_response *ulwi_http_response(int handle);
+bool response_handle_readable(int handle);
 
-void insert_field_http_request(enum http_data type, struct mg_str *line, struct http_request *http_array);
-int get_available_handle(struct http_request * request_array);
+bool ulwi_request_set_url(struct http_request *request, struct mg_str url);
+bool ulwi_request_set_captures(struct http_request *request, struct mg_str names);
+void ulwi_append_captured(const struct http_response *s, struct mg_str name, struct mbuf *reply);
+enum http_append ulwi_http_append_body(int handle, struct mg_str data, bool last);
+void insert_field_http_request(enum http_data type, struct mg_str params, struct mbuf *reply);
 void ulwi_empty_response(struct http_response *s);
+bool ulwi_read_response(struct http_response *s, int64_t offset, size_t length, struct mbuf *reply);
+int64_t ulwi_response_stored(const struct http_response *s);
+uint32_t ulwi_response_digest(const struct http_response *s);
+void ulwi_response_mark_read(struct http_response *s);
+bool ulwi_response_modified(const struct http_response *s);
 void ulwi_empty_request(struct http_request *r);
-int validate_handle_string(char *handle_char);
 
 #endif
@@ -0,0 +1,337 @@
+#include "job.h"
+#include "http.h"
+#include "event.h"
+#include "constants.h"
+#include "reply.h"
+
+#include "mgos_mqtt.h"
+
+enum job_kind
+{
+    JOB_FREE,   /* The job is not scheduled */
+    JOB_HTTP,   /* Transmits the request of a HTTP handle */
+    JOB_MQTT    /* Publishes a fixed MQTT message */
+};
+
+/* A scheduled job. Only the latest result is kept: an HTTP job leaves it in
+   its handle, where the usual commands read it, and an MQTT job only has
+   its outcome. */
+struct job
+{
+    enum job_kind kind;
+    unsigned int interval;      /* Seconds between runs, before backoff and jitter */
+    mgos_timer_id timer;        /* Timer of the next run, invalid while an HTTP run is in progress */
+    bool running;               /* Whether an HTTP run is waiting for its response */
+    int handle;                 /* Handle of a HTTP job */
+    char *topic;                /* Topic of an MQTT job */
+    char *message;              /* Message of an MQTT job */
+    size_t message_len;
+    int qos;
+    bool retain;
+    char result;                /* N before the first run, then S or U as shr would reply */
+    uint32_t digest;            /* Digest of the last result, to tell whether it changed */
+    bool changed;               /* Whether the result changed since the master last read the job */
+    uint32_t runs;              /* Number of runs since the job was scheduled */
+    uint32_t failures;          /* Number of consecutive failed runs */
+};
+
+static struct job jobs[JOBS_MAX];
+
+static void job_run_cb(void *arg);
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: schedule                                                    *
+ *                                                                            *
+ * PURPOSE: Arms the timer of the next run of a job. The interval is doubled  *
+ *          for each consecutive failure, up to JOB_BACKOFF_MAX times and     *
+ *          JOB_INTERVAL_MAX, and then moved by up to JOB_JITTER_PERCENT so   *
+ *          that jobs and modules started together do not stay in step.       *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE    I/O DESCRIPTION                                           *
+ * -------- ------- --- -----------                                           *
+ * job      job *   I/O The job                                               *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+static void schedule(struct job *job)
+{
+    const unsigned int shift = job->failures < JOB_BACKOFF_MAX ? job->failures : JOB_BACKOFF_MAX;
+    int64_t delay = (int64_t)job->interval << shift;
+    if (delay > JOB_INTERVAL_MAX)
+    {
+        delay = JOB_INTERVAL_MAX;
+    }
+    delay *= 1000;
+    delay += (int64_t)(delay * mgos_rand_range(-JOB_JITTER_PERCENT, JOB_JITTER_PERCENT) / 100);
+    job->timer = mgos_set_timer((int)delay, 0, job_run_cb, job);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: job_done                                                    *
+ *                                                                            *
+ * PURPOSE: Records the result of a run, flags the job if the result differs  *
+ *          from the previous one, and schedules the next run                 *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE     I/O DESCRIPTION                                          *
+ * -------- -------- --- -----------                                          *
+ * job      job *    I/O The job                                              *
+ * result   char      I  S if the run succeeded, U otherwise                  *
+ * digest   uint32_t  I  Digest of what the run produced                      *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+static void job_done(struct job *job, char result, uint32_t digest)
+{
+    job->running = false;
+    job->runs++;
+    job->failures = result == 'S' ? 0 : job->failures + 1;
+    if (job->result != result || job->digest != digest)
+    {
+        job->result = result;
+        job->digest = digest;
+        job->changed = true;
+        ulwi_event_job(job - jobs);
+    }
+    schedule(job);
+}
+
+/* Runs a job when its timer fires */
+static void job_run_cb(void *arg)
+{
+    struct job *job = (struct job *)arg;
+    job->timer = MGOS_INVALID_TIMER_ID;
+
+    switch (job->kind)
+    {
+    case JOB_HTTP: {
+        const struct http_response *response = ulwi_http_response(job->handle);
+        if (response != NULL && response->progress == IN_PROGRESS)
+        {
+            /* The master is using the handle, try again next time */
+            schedule(job);
+            break;
+        }
+        /* The response may finish, and reschedule the job, before this returns */
+        job->running = true;
+        if (!ulwi_http_start(job->handle, false, 0, -1) && job->running)
+        {
+            job_done(job, FAILED, 0);
+        }
+        break;
+    }
+    case JOB_MQTT: {
+        const bool published = mgos_mqtt_pub(job->topic, job->message, job->message_len, job->qos, job->retain);
+        job_done(job, published ? SUCCESS : FAILED, 0);
+        break;
+    }
+    case JOB_FREE:
+        break;
+    }
+}
+
+/* Copies a string to the heap, NUL terminated even if it is empty */
+static char *copy_str(struct mg_str str)
+{
+    char *copy = malloc(str.len + 1);
+    if (copy != NULL)
+    {
+        memcpy(copy, str.p, str.len);
+        copy[str.len] = '\0';
+    }
+    return copy;
+}
+
+/* Takes a job for scheduling anew, freeing whatever it was before */
+static struct job *claim(int job)
+{
+    if (job < 0 || job >= JOBS_MAX)
+    {
+        return NULL;
+    }
+    ulwi_job_remove(job);
+    return &jobs[job];
+}
+
+/* Starts a job, running it for the first time straight away */
+static void start(struct job *job, unsigned int interval)
+{
+    job->interval = interval;
+    job->result = NONEXISTENT;
+    job->timer = mgos_set_timer(0, 0, job_run_cb, job);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_job_set_http                                           *
+ *                                                                            *
+ * PURPOSE: Schedules a job that transmits the request of a HTTP handle,      *
+ *          replacing whatever the job was before                             *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE          I/O DESCRIPTION                                     *
+ * -------- ------------- --- -----------                                     *
+ * job      int            I  The job                                         *
+ * interval unsigned int   I  Seconds between runs                            *
+ * handle   int            I  The handle, which must exist                    *
+ *                                                                            *
+ * RETURNS: false if the job or handle does not exist, or another job         *
+ *          already transmits the handle                                      *
+ *                                                                            *
+ *****************************************************************************/
+bool ulwi_job_set_http(int job, unsigned int interval, int handle)
+{
+    if (ulwi_http_request(handle) == NULL)
+    {
+        return false;
+    }
+    for (int i = 0; i < JOBS_MAX; i++)
+    {
+        if (i != job && jobs[i].kind == JOB_HTTP && jobs[i].handle == handle)
+        {
+            return false;
+        }
+    }
+    struct job *slot = claim(job);
+    if (slot == NULL)
+    {
+        return false;
+    }
+    slot->kind = JOB_HTTP;
+    slot->handle = handle;
+    start(slot, interval);
+    return true;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_job_set_mqtt                                           *
+ *                                                                            *
+ * PURPOSE: Schedules a job that publishes an MQTT message, replacing         *
+ *          whatever the job was before                                       *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE          I/O DESCRIPTION                                     *
+ * -------- ------------- --- -----------                                     *
+ * job      int            I  The job                                         *
+ * interval unsigned int   I  Seconds between runs                            *
+ * topic    mg_str         I  The topic to publish to                         *
+ * message  mg_str         I  The message to publish                          *
+ * qos      int            I  Quality of service, 0 or 1                      *
+ * retain   bool           I  Whether the message is retained                 *
+ *                                                                            *
+ * RETURNS: false if the job does not exist or the heap is full               *
+ *                                                                            *
+ *****************************************************************************/
+bool ulwi_job_set_mqtt(int job, unsigned int interval, struct mg_str topic, struct mg_str message, int qos, bool retain)
+{
+    struct job *slot = claim(job);
+    if (slot == NULL)
+    {
+        return false;
+    }
+    slot->topic = copy_str(topic);
+    slot->message = copy_str(message);
+    if (slot->topic == NULL || slot->message == NULL)
+    {
+        ulwi_job_remove(job);
+        return false;
+    }
+    slot->kind = JOB_MQTT;
+    slot->message_len = message.len;
+    slot->qos = qos;
+    slot->retain = retain;
+    start(slot, interval);
+    return true;
+}
+
+/* Stops a job and frees it, ignoring jobs that do not exist */
+void ulwi_job_remove(int job)
+{
+    if (job < 0 || job >= JOBS_MAX)
+    {
+        return;
+    }
+    struct job *slot = &jobs[job];
+    if (slot->timer != MGOS_INVALID_TIMER_ID)
+    {
+        mgos_clear_timer(slot->timer);
+    }
+    free(slot->topic);
+    free(slot->message);
+    memset(slot, 0, sizeof(*slot));
+}
+
+/* Completes the run of the job that transmits a handle, if it is running */
+void ulwi_job_http_finished(int handle)
+{
+    for (int i = 0; i < JOBS_MAX; i++)
+    {
+        struct job *job = &jobs[i];
+        if (job->kind == JOB_HTTP && job->handle == handle && job->running)
+        {
+            const struct http_response *response = ulwi_http_response(handle);
+            job_done(job, (char)response->progress, response->digest);
+        }
+    }
+}
+
+/* Removes the job that transmits a handle, as the handle is being deleted */
+void ulwi_job_handle_deleted(int handle)
+{
+    for (int i = 0; i < JOBS_MAX; i++)
+    {
+        if (jobs[i].kind == JOB_HTTP && jobs[i].handle == handle)
+        {
+            ulwi_job_remove(i);
+        }
+    }
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_job_read                                               *
+ *                                                                            *
+ * PURPOSE: Appends the state of a job to a reply and clears its change flag  *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE    I/O DESCRIPTION                                           *
+ * -------- ------- --- -----------                                           *
+ * job      int      I  The job                                               *
+ * reply    mbuf *   O  The reply buffer                                      *
+ *                                                                            *
+ * RETURNS: false if the job is not scheduled                                 *
+ *                                                                            *
+ *****************************************************************************/
+bool ulwi_job_read(int job, struct mbuf *reply)
+{
+    if (job < 0 || job >= JOBS_MAX || jobs[job].kind == JOB_FREE)
+    {
+        return false;
+    }
+    struct job *slot = &jobs[job];
+    ulwi_reply_printf(reply, "%c%s%c%s%u%s%u", slot->changed ? 'T' : 'F', ULWI_DELIMITER,
+                      slot->running ? IN_PROGRESS : slot->result, ULWI_DELIMITER,
+                      (unsigned)slot->runs, ULWI_DELIMITER, (unsigned)slot->failures);
+    slot->changed = false;
+    return true;
+}
+
+/* Appends T for each job whose result changed since it was last read, F otherwise */
+void ulwi_job_append_changed(struct mbuf *reply)
+{
+    for (int i = 0; i < JOBS_MAX; i++)
+    {
+        mbuf_append(reply, jobs[i].changed ? "T" : "F", 1);
+    }
+}
@@ -0,0 +1,44 @@
+/******************************************************************************
+ *                                                                            *
+ * NAME: job.h                                                                *
+ *                                                                            *
+ * PURPOSE: Provides periodic HTTP requests and MQTT publishes that run on    *
+ *          the module without the master driving them                        *
+ *                                                                            *
+ * GLOBAL VARIABLES:                                                          *
+ *                                                                            *
+ * Variable Type Description                                                  *
+ * -------- ---- -----------                                                  *
+ *                                                                            *
+ *                                                                            *
+ *****************************************************************************/
+
+#ifndef JOB_H
+#define JOB_H
+
+#include "mgos.h"
+
+/* Jobs that can be scheduled at once, numbered from 0 */
+#ifndef JOBS_MAX
+#define JOBS_MAX 4
+#endif
+/* Shortest and longest interval of a job, in seconds */
+#define JOB_INTERVAL_MIN 5
+#define JOB_INTERVAL_MAX 86400
+/* Consecutive failures double the interval up to this many times */
+#define JOB_BACKOFF_MAX 5
+/* Each run is moved by up to this percentage of its interval either way */
+#define JOB_JITTER_PERCENT 10
+/* Longest topic and message of an MQTT job */
+#define JOB_TOPIC_MAX 64
+#define JOB_MESSAGE_MAX 128
+
+bool ulwi_job_set_http(int job, unsigned int interval, int handle);
+bool ulwi_job_set_mqtt(int job, unsigned int interval, struct mg_str topic, struct mg_str message, int qos, bool retain);
+void ulwi_job_remove(int job);
+void ulwi_job_http_finished(int handle);
+void ulwi_job_handle_deleted(int handle);
+bool ulwi_job_read(int job, struct mbuf *reply);
+void ulwi_job_append_changed(struct mbuf *reply);
+
+#endif
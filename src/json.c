@@ -0,0 +1,448 @@
+#include "json.h"
+#include "constants.h"
+
+enum json_state
+{
+    JSON_VALUE,         /* Expecting a value */
+    JSON_VALUE_OR_END,  /* Expecting the first element of an array or ] */
+    JSON_KEY_OR_END,    /* Expecting the first key of an object or } */
+    JSON_KEY_START,     /* Expecting a key after a comma */
+    JSON_KEY,           /* Reading a key */
+    JSON_COLON,         /* Expecting the colon after a key */
+    JSON_STRING,        /* Reading a string value */
+    JSON_LITERAL,       /* Reading a number, true, false or null */
+    JSON_AFTER_VALUE,   /* Expecting a comma or the end of an object or array */
+    JSON_DONE,          /* The root value has been read */
+    JSON_ERROR          /* The content is not JSON, or is nested too deeply */
+};
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_json_add_path                                          *
+ *                                                                            *
+ * PURPOSE: Adds a path to extract, made of keys separated by dots and array  *
+ *          indexes in brackets, such as main.temp or weather[0].description *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE             I/O DESCRIPTION                                  *
+ * -------- ---------------- --- -----------                                  *
+ * json     json_extractor * I/O The extractor to add the path to             *
+ * path     mg_str            I  The path                                     *
+ *                                                                            *
+ * RETURNS: false if the path is malformed or there are too many paths        *
+ *                                                                            *
+ *****************************************************************************/
+bool ulwi_json_add_path(struct json_extractor *json, struct mg_str path)
+{
+    if (json->path_count == JSON_PATHS_MAX || path.len == 0 || path.len >= JSON_PATH_MAX)
+    {
+        return false;
+    }
+    struct json_path *p = &json->paths[json->path_count];
+    memcpy(p->text, path.p, path.len);
+    p->text[path.len] = '\0';
+    p->segments = 0;
+
+    size_t i = 0;
+    while (i < path.len)
+    {
+        if (p->segments == JSON_SEGMENTS_MAX)
+        {
+            return false;
+        }
+        if (p->text[i] == '[')
+        {
+            /* Array index */
+            long index = 0;
+            size_t digits = 0;
+            for (i++; i < path.len && isdigit((int)p->text[i]) && digits < 4; i++, digits++)
+            {
+                index = index * 10 + (p->text[i] - '0');
+            }
+            if (digits == 0 || i == path.len || p->text[i] != ']')
+            {
+                return false;
+            }
+            p->index[p->segments++] = (int16_t)index;
+            i++;
+            if (i < path.len && p->text[i] == '.')
+            {
+                i++;
+                if (i == path.len) return false;
+            }
+            continue;
+        }
+
+        /* Key, up to the next dot or bracket */
+        const size_t start = i;
+        while (i < path.len && p->text[i] != '.' && p->text[i] != '[')
+        {
+            i++;
+        }
+        if (i == start)
+        {
+            return false;
+        }
+        p->key_start[p->segments] = start;
+        p->key_len[p->segments] = i - start;
+        p->index[p->segments++] = -1;
+        if (i < path.len && p->text[i] == '.')
+        {
+            i++;
+            if (i == path.len) return false;
+        }
+    }
+    json->path_count++;
+    return true;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_json_reset                                             *
+ *                                                                            *
+ * PURPOSE: Prepares an extractor for new content, keeping its paths but      *
+ *          forgetting the values found previously                            *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE             I/O DESCRIPTION                                  *
+ * -------- ---------------- --- -----------                                  *
+ * json     json_extractor *  O  The extractor to reset                       *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+void ulwi_json_reset(struct json_extractor *json)
+{
+    for (uint8_t i = 0; i < json->path_count; i++)
+    {
+        json->paths[i].value_len = 0;
+        json->paths[i].found = false;
+    }
+    json->state = JSON_VALUE;
+    json->depth = 0;
+    json->value_mask = (1 << json->path_count) - 1;
+    json->capture = 0;
+    json->escape = false;
+}
+
+/* Paths in mask whose segment at depth is a key, or the given array index */
+static uint8_t match_segment(const struct json_extractor *json, uint8_t mask, uint8_t depth, int16_t index)
+{
+    uint8_t matched = 0;
+    for (uint8_t i = 0; i < json->path_count; i++)
+    {
+        const struct json_path *p = &json->paths[i];
+        if ((mask & (1 << i)) && depth < p->segments && p->index[depth] == index)
+        {
+            matched |= 1 << i;
+        }
+    }
+    return matched;
+}
+
+/* Paths in the value mask that end at the current depth, i.e. whose value is
+   the one about to be read */
+static uint8_t terminal_paths(const struct json_extractor *json)
+{
+    uint8_t terminal = 0;
+    for (uint8_t i = 0; i < json->path_count; i++)
+    {
+        if ((json->value_mask & (1 << i)) && json->paths[i].segments == json->depth)
+        {
+            terminal |= 1 << i;
+        }
+    }
+    return terminal;
+}
+
+/* Appends a character of a scalar to every path capturing it */
+static void capture_char(struct json_extractor *json, char c)
+{
+    for (uint8_t i = 0; i < json->path_count; i++)
+    {
+        struct json_path *p = &json->paths[i];
+        if ((json->capture & (1 << i)) && p->value_len < JSON_VALUE_MAX - 1)
+        {
+            p->value[p->value_len++] = c;
+        }
+    }
+}
+
+/* Marks the scalar that was being captured as found */
+static void end_scalar(struct json_extractor *json)
+{
+    for (uint8_t i = 0; i < json->path_count; i++)
+    {
+        if (json->capture & (1 << i))
+        {
+            json->paths[i].found = true;
+        }
+    }
+    json->capture = 0;
+    json->state = JSON_AFTER_VALUE;
+}
+
+/* Enters an object or array */
+static void push_frame(struct json_extractor *json, char type)
+{
+    if (json->depth == JSON_DEPTH_MAX)
+    {
+        json->state = JSON_ERROR;
+        return;
+    }
+    struct json_frame *frame = &json->stack[json->depth++];
+    frame->type = type;
+    frame->index = 0;
+    frame->mask = json->value_mask;
+    if (type == '[')
+    {
+        json->value_mask = match_segment(json, frame->mask, json->depth - 1, 0);
+        json->state = JSON_VALUE_OR_END;
+    }
+    else
+    {
+        json->state = JSON_KEY_OR_END;
+    }
+}
+
+/* Leaves an object or array */
+static void pop_frame(struct json_extractor *json, char type)
+{
+    if (json->depth == 0 || json->stack[json->depth - 1].type != type)
+    {
+        json->state = JSON_ERROR;
+        return;
+    }
+    json->depth--;
+    json->state = json->depth == 0 ? JSON_DONE : JSON_AFTER_VALUE;
+}
+
+/* Handles the first character of a value */
+static void start_value(struct json_extractor *json, char c)
+{
+    switch (c)
+    {
+    case '{':
+    case '[':
+        push_frame(json, c);
+        break;
+    case '"':
+        json->capture = terminal_paths(json);
+        json->escape = false;
+        json->state = JSON_STRING;
+        break;
+    default:
+        if (c == '-' || isalnum((int)c))
+        {
+            json->capture = terminal_paths(json);
+            capture_char(json, c);
+            json->state = JSON_LITERAL;
+        }
+        else
+        {
+            json->state = JSON_ERROR;
+        }
+        break;
+    }
+}
+
+/* Starts reading a key of the innermost object */
+static void start_key(struct json_extractor *json)
+{
+    const struct json_frame *frame = &json->stack[json->depth - 1];
+    json->key_mask = match_segment(json, frame->mask, json->depth - 1, -1);
+    json->key_pos = 0;
+    json->escape = false;
+    json->state = JSON_KEY;
+}
+
+/* Compares a character of the key being read with every candidate path */
+static void key_char(struct json_extractor *json, char c)
+{
+    const uint8_t segment = json->depth - 1;
+    for (uint8_t i = 0; i < json->path_count; i++)
+    {
+        const struct json_path *p = &json->paths[i];
+        if ((json->key_mask & (1 << i)) &&
+            (json->key_pos >= p->key_len[segment] || p->text[p->key_start[segment] + json->key_pos] != c))
+        {
+            json->key_mask &= ~(1 << i);
+        }
+    }
+    if (json->key_pos < UINT8_MAX) json->key_pos++;
+}
+
+/* Keeps the candidate paths whose key was matched in full */
+static void end_key(struct json_extractor *json)
+{
+    const uint8_t segment = json->depth - 1;
+    for (uint8_t i = 0; i < json->path_count; i++)
+    {
+        if ((json->key_mask & (1 << i)) && json->paths[i].key_len[segment] != json->key_pos)
+        {
+            json->key_mask &= ~(1 << i);
+        }
+    }
+    json->value_mask = json->key_mask;
+    json->state = JSON_COLON;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_json_feed                                              *
+ *                                                                            *
+ * PURPOSE: Parses the next piece of the content, keeping the scalar values   *
+ *          found at the extractor's paths. Pieces can split the content      *
+ *          anywhere, and nothing but the values is kept, so memory use does  *
+ *          not depend on the size of the content. Strings are kept with      *
+ *          their escape sequences as they appear in the content.             *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE             I/O DESCRIPTION                                  *
+ * -------- ---------------- --- -----------                                  *
+ * json     json_extractor * I/O The extractor                                *
+ * data     char *            I  The next piece of content                    *
+ * len      size_t            I  Length of the piece                          *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+void ulwi_json_feed(struct json_extractor *json, const char *data, size_t len)
+{
+    for (size_t i = 0; i < len && json->state < JSON_DONE; i++)
+    {
+        const char c = data[i];
+        const bool space = c == ' ' || c == '\t' || c == '\r' || c == '\n';
+
+        switch (json->state)
+        {
+        case JSON_VALUE_OR_END:
+            if (c == ']')
+            {
+                pop_frame(json, '[');
+                break;
+            }
+            /* fallthrough */
+        case JSON_VALUE:
+            if (!space) start_value(json, c);
+            break;
+        case JSON_KEY_OR_END:
+            if (c == '}')
+            {
+                pop_frame(json, '{');
+                break;
+            }
+            /* fallthrough */
+        case JSON_KEY_START:
+            if (c == '"') start_key(json);
+            else if (!space) json->state = JSON_ERROR;
+            break;
+        case JSON_KEY:
+            if (json->escape)
+            {
+                json->escape = false;
+                key_char(json, c);
+            }
+            else if (c == '\\') json->escape = true;
+            else if (c == '"') end_key(json);
+            else key_char(json, c);
+            break;
+        case JSON_COLON:
+            if (c == ':') json->state = JSON_VALUE;
+            else if (!space) json->state = JSON_ERROR;
+            break;
+        case JSON_STRING:
+            if (json->escape)
+            {
+                json->escape = false;
+                capture_char(json, c);
+            }
+            else if (c == '"')
+            {
+                end_scalar(json);
+            }
+            else
+            {
+                json->escape = (c == '\\');
+                capture_char(json, c);
+            }
+            break;
+        case JSON_LITERAL:
+            if (c == '-' || c == '+' || c == '.' || isalnum((int)c))
+            {
+                capture_char(json, c);
+                break;
+            }
+            end_scalar(json);
+            /* This character ends the literal, so it is handled as what follows it */
+            i--;
+            break;
+        case JSON_AFTER_VALUE:
+            if (c == ',')
+            {
+                struct json_frame *frame = &json->stack[json->depth - 1];
+                if (frame->type == '[')
+                {
+                    frame->index++;
+                    json->value_mask = match_segment(json, frame->mask, json->depth - 1, frame->index);
+                    json->state = JSON_VALUE;
+                }
+                else
+                {
+                    json->state = JSON_KEY_START;
+                }
+            }
+            else if (c == '}' || c == ']')
+            {
+                pop_frame(json, c == '}' ? '{' : '[');
+            }
+            else if (!space)
+            {
+                json->state = JSON_ERROR;
+            }
+            break;
+        }
+    }
+}
+
+/* Returns whether the content fed so far was malformed or nested too deeply */
+bool ulwi_json_failed(const struct json_extractor *json)
+{
+    return json->state == JSON_ERROR;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_json_append_values                                     *
+ *                                                                            *
+ * PURPOSE: Appends the values found, in the order their paths were added and *
+ *          delimited with ULWI_DELIMITER. A path with no scalar value found  *
+ *          is left empty.                                                    *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE             I/O DESCRIPTION                                  *
+ * -------- ---------------- --- -----------                                  *
+ * json     json_extractor *  I  The extractor                                *
+ * reply    mbuf *            O  The reply buffer to append the values to     *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+void ulwi_json_append_values(const struct json_extractor *json, struct mbuf *reply)
+{
+    for (uint8_t i = 0; i < json->path_count; i++)
+    {
+        if (i > 0)
+        {
+            mbuf_append(reply, ULWI_DELIMITER, 1);
+        }
+        if (json->paths[i].found)
+        {
+            mbuf_append(reply, json->paths[i].value, json->paths[i].value_len);
+        }
+    }
+}
@@ -0,0 +1,67 @@
+/******************************************************************************
+ *                                                                            *
+ * NAME: json.h                                                               *
+ *                                                                            *
+ * PURPOSE: Provides streaming extraction of JSON fields from HTTP content    *
+ *                                                                            *
+ * GLOBAL VARIABLES:                                                          *
+ *                                                                            *
+ * Variable Type Description                                                  *
+ * -------- ---- -----------                                                  *
+ *                                                                            *
+ *                                                                            *
+ *****************************************************************************/
+
+#ifndef JSON_H
+#define JSON_H
+
+#include "mgos.h"
+
+#define JSON_PATHS_MAX 4        /* Paths that can be extracted from one response */
+#define JSON_PATH_MAX 64        /* Longest path, including its terminator */
+#define JSON_SEGMENTS_MAX 8     /* Most keys and indexes in a path */
+#define JSON_VALUE_MAX 48       /* Longest value kept, longer values are truncated */
+#define JSON_DEPTH_MAX 16       /* Deepest nesting of objects and arrays that can be parsed */
+
+struct json_path
+{
+    char text[JSON_PATH_MAX];                   /* The path, with its separators replaced by null terminators */
+    uint8_t segments;                           /* Number of keys and indexes in the path */
+    uint8_t key_start[JSON_SEGMENTS_MAX];       /* Offset of each key in text */
+    uint8_t key_len[JSON_SEGMENTS_MAX];         /* Length of each key */
+    int16_t index[JSON_SEGMENTS_MAX];           /* Array index of each segment, -1 if it is a key */
+    char value[JSON_VALUE_MAX];                 /* The scalar value found at the path */
+    uint8_t value_len;
+    bool found;                                 /* Whether a scalar value was found at the path */
+};
+
+struct json_frame
+{
+    char type;          /* { or [ */
+    uint16_t index;     /* Index of the current element of an array */
+    uint8_t mask;       /* Paths that match the location of this object or array */
+};
+
+struct json_extractor
+{
+    struct json_path paths[JSON_PATHS_MAX];
+    uint8_t path_count;
+
+    /* Parser state, which stays the same size however large the content is */
+    uint8_t state;
+    uint8_t depth;
+    struct json_frame stack[JSON_DEPTH_MAX];
+    uint8_t value_mask;     /* Paths that match the location of the next value */
+    uint8_t key_mask;       /* Paths whose key still matches the key being read */
+    uint8_t key_pos;        /* Characters of the key read so far */
+    uint8_t capture;        /* Paths that the scalar being read is the value of */
+    bool escape;            /* Whether the previous character in a string was a backslash */
+};
+
+bool ulwi_json_add_path(struct json_extractor *json, struct mg_str path);
+void ulwi_json_reset(struct json_extractor *json);
+void ulwi_json_feed(struct json_extractor *json, const char *data, size_t len);
+bool ulwi_json_failed(const struct json_extractor *json);
+void ulwi_json_append_values(const struct json_extractor *json, struct mbuf *reply);
+
+#endif
@@ -40,12 +40,45 @@
 #include "wifi.h"
 #include "http.h"
 #include "mqtt.h"
+#include "reply.h"
+#include "baud.h"
+#include "txqueue.h"
+#include "event.h"
+#include "pool.h"
+#include "tls.h"
+#include "dns.h"
+#include "job.h"
+#include "cache.h"
+#include "cond.h"
 
 /* TODO: Comment out the definition if in production!! */
 #define DEVELOPMENT
 
-static struct http_request http_array[HTTP_HANDLES_MAX];
-static struct http_response response_array[HTTP_HANDLES_MAX];
+/* Counters for the number of command lines handled per UART wakeup */
+struct dispatch_stats
+{
+    uint32_t wakeups;           /* Number of wakeups that handled at least one line */
+    uint32_t lines;             /* Total number of lines handled */
+    uint32_t budget_exhausted;  /* Number of wakeups that hit UART_DISPATCH_LINE_BUDGET */
+    uint8_t last_lines;         /* Lines handled by the most recent wakeup */
+    uint8_t max_lines;          /* Most lines handled by a single wakeup */
+};
+static struct dispatch_stats dispatch_stats;
+
+/* Fixed size receive buffer for command lines. Bytes before scanned have
+   already been examined for a CRLF, so each byte is only scanned once */
+struct rx_buffer
+{
+    char buf[UART_RX_BUF_SIZE];
+    size_t len;         /* Number of bytes held in buf */
+    size_t scanned;     /* Number of bytes already examined for a line ending */
+    size_t line_start;  /* Start of the line or binary frame currently being received */
+    bool last_cr;       /* Whether the last scanned byte was a CR */
+    bool discarding;    /* Whether an overflowed line is being dropped until its CRLF,
+                           or bytes are dropped until a valid binary frame */
+    enum link_mode mode;    /* Link mode the last byte or frame was scanned in */
+};
+static struct rx_buffer rx;
 
 #ifdef DEVELOPMENT
 /******************************************************************************
@@ -69,6 +102,1478 @@ static struct http_response response_array[HTTP_HANDLES_MAX];
 // }
 #endif /* DEVELOPMENT */
 
+/******************************************************************************
+ *                                                                            *
+ * COMMAND HANDLERS                                                           *
+ *                                                                            *
+ * PURPOSE: Every command in the instruction set is implemented by one        *
+ *          handler below, which is reached through the command_table. The    *
+ *          dispatcher has already validated the length of the parameters     *
+ *          against the limits declared in the table before calling the       *
+ *          handler, and it applies the declared framing to whatever the      *
+ *          handler appended to the reply buffer, so handlers only produce    *
+ *          the reply payload. Parameters are the text after the mnemonic and *
+ *          its space in text mode, or the frame payload in binary mode.      *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE    I/O DESCRIPTION                                           *
+ * -------- ------- --- -----------                                           *
+ * params   mg_str   I  The parameters of the command, null terminated        *
+ * reply    mbuf *   O  The reply payload, without framing                    *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+
+static void cmd_nop(struct mg_str params, struct mbuf *reply)
+{
+    /* No Operation, the framing alone produces the blank reply */
+    (void)params;
+    (void)reply;
+}
+
+static void cmd_ver(struct mg_str params, struct mbuf *reply)
+{
+    /* Print Version */
+    ulwi_reply_puts(reply, mgos_sys_config_get_version());
+    (void)params;
+}
+
+/* Resets the device once the acknowledgement of a pipelined rst is sent */
+static void restart_cb(void *arg)
+{
+    ulwi_txq_flush();
+    mgos_system_restart();
+    (void)arg;
+}
+
+static void cmd_rst(struct mg_str params, struct mbuf *reply)
+{
+    /* Reset device */
+    if (ulwi_link_tagged())
+    {
+        mgos_set_timer(0, 0, restart_cb, NULL);
+    }
+    else
+    {
+        mgos_system_restart();
+    }
+    (void)params;
+    (void)reply;
+}
+
+static void cmd_lap(struct mg_str params, struct mbuf *reply)
+{
+    /* List Access Points, the reply is sent asynchronously by wifi_scan_cb */
+    const int slot = ulwi_reply_defer(OPCODE_LAP);
+    if (slot < 0)
+    {
+        ulwi_reply_error(OPCODE_LAP, REPLY_BUSY, FRAME_CRLF);
+        return;
+    }
+    /* We need to ensure that Wi-Fi radio is enabled, even temporarily,
+       for this purpose */
+    float rand = mgos_rand_range(0.0f, 100.0f);
+    char buf[10];
+    snprintf(buf, 10, "%f", rand);
+    const struct mgos_config_wifi_ap ap_config = 
+    { 
+        .enable = true,
+        .ssid = buf,
+        .dhcp_start = "10.1.0.2",
+        .dhcp_end = "10.1.0.9",
+        .ip = "10.1.0.1",
+        .netmask = "255.255.255.0",
+        .gw = "10.1.0.1",
+        .hidden = true
+    };
+    mgos_wifi_setup_ap(&ap_config);
+    mgos_wifi_scan(wifi_scan_cb, (void *)(intptr_t)slot);
+    (void)params;
+    (void)reply;
+}
+
+static void cmd_cap(struct mg_str params, struct mbuf *reply)
+{
+    /* Connect to Access Point */
+    struct mg_str result[5];
+    const int param_len = ulwi_split_params(params, result, 5);
+    
+    if (param_len == 2)
+    {
+        const struct mgos_config_wifi_sta wifi_config = 
+        { 
+            .enable = true, 
+            .ssid = result[0].p,
+            .pass = result[1].p
+        };
+        mgos_wifi_setup_sta(&wifi_config);
+    }
+    else if (param_len == 3)
+    {
+        const struct mgos_config_wifi_sta wifi_config = 
+        { 
+            .enable = true, 
+            .ssid = result[0].p,
+            .user = result[1].p,
+            .pass = result[2].p
+        };
+        mgos_wifi_setup_sta(&wifi_config);
+    }
+    else if (param_len == 5)
+    {
+        const struct mgos_config_wifi_sta wifi_config = 
+        { 
+            .enable = true,
+            .ssid = result[0].p,
+            .pass = result[1].p,
+            .ip = result[2].p,
+            .gw = result[3].p,
+            .netmask = result[4].p
+        };
+        mgos_wifi_setup_sta(&wifi_config);
+    }
+    else
+    {
+        ulwi_reply_puts(reply, "invalid");
+    }
+}
+
+static void cmd_sap(struct mg_str params, struct mbuf *reply)
+{
+    /* Status of Access Point */
+    const char state[2] = { ulwi_wifi_state(), '\0' };
+    ulwi_reply_puts(reply, state);
+    (void)params;
+}
+
+static void cmd_dap(struct mg_str params, struct mbuf *reply)
+{
+    /* Disconnect from Access Point */
+    char *ssid = mgos_wifi_get_connected_ssid();
+    if (ssid)
+    {
+        LOG(LL_DEBUG, ("attempting disconnect from wifi"));
+        const struct mgos_config_wifi_sta wifi_config = { false };
+        mgos_wifi_setup_sta(&wifi_config);
+    }
+    else
+    {
+        LOG(LL_DEBUG, ("not attempting disconnect from wifi"));
+    }
+    free(ssid);
+    (void)params;
+    (void)reply;
+}
+
+static void cmd_gip(struct mg_str params, struct mbuf *reply)
+{
+    /* Get IP */
+    struct mgos_net_ip_info ip_information;
+    mgos_net_get_ip_info(MGOS_NET_IF_TYPE_WIFI, MGOS_NET_IF_WIFI_STA, &ip_information);
+    char ip[16];
+    mgos_net_ip_to_str(&ip_information.ip, ip);
+    ulwi_reply_puts(reply, ip);
+    (void)params;
+}
+
+static void cmd_ihr(struct mg_str params, struct mbuf *reply)
+{
+    /* Initialise HTTP Request */
+    struct ulwi_params cursor;
+    char method;
+    struct mg_str url;
+    ulwi_params_init(&cursor, params);
+    if (!ulwi_param_char(&cursor, "GP", &method) || !ulwi_param_str(&cursor, &url))
+    {
+        ulwi_reply_puts(reply, "short");
+        return;
+    }
+
+    const int handle = ulwi_http_create(); /* Returns -1 if no handle available */
+
+    if (handle != -1)
+    {
+        struct http_request *request = ulwi_http_request(handle);
+
+        request->method = method;
+        if (!ulwi_request_set_url(request, url))
+        {
+            ulwi_http_delete(handle);
+            ulwi_reply_puts(reply, "long");
+            return;
+        }
+        ulwi_reply_printf(reply, "%i", handle);
+        LOG(LL_INFO, ("request type: %c, url: %s", request->method, request->url.p));
+    }
+    else
+    {
+        /* Failed to create handle, most likely it ran out */
+        ulwi_reply_puts(reply, "U");
+    }
+}
+
+static void cmd_phr(struct mg_str params, struct mbuf *reply)
+{
+    /* Parameter of HTTP request */
+    insert_field_http_request(POST_FIELD, params, reply);
+}
+
+static void cmd_hhr(struct mg_str params, struct mbuf *reply)
+{
+    /* Header of HTTP request */
+    insert_field_http_request(HEADER, params, reply);
+}
+
+static void cmd_thr(struct mg_str params, struct mbuf *reply)
+{
+    /* Transmit HTTP request */
+    struct ulwi_params cursor;
+    int handle;
+    bool streaming = false;
+    long priority = 0;
+    ulwi_params_init(&cursor, params);
+    if (ulwi_param_handle(&cursor, &handle) && (cursor.next == NULL || ulwi_param_bool(&cursor, &streaming)) &&
+        (cursor.next == NULL || ulwi_param_int(&cursor, 0, HTTP_PRIORITY_MAX, &priority)))
+    {
+        /* In pipelining mode the reply waits for the request to finish, so
+           that the master does not have to poll shr for it */
+        int slot = -1;
+        if (ulwi_link_tagged() && (slot = ulwi_reply_defer(OPCODE_THR)) < 0)
+        {
+            ulwi_reply_error(OPCODE_THR, REPLY_BUSY, FRAME_CRLF);
+        }
+        else if (!ulwi_http_start(handle, streaming, (uint8_t)priority, slot))
+        {
+            if (slot >= 0)
+            {
+                ulwi_reply_complete(slot, FRAME_CRLF, "U", 1);
+            }
+            else
+            {
+                ulwi_reply_puts(reply, "U");
+            }
+        }
+        else if (slot < 0)
+        {
+            ulwi_reply_puts(reply, "S");
+        }
+    }
+    else
+    {
+        /* Invalid handle */
+        ulwi_reply_puts(reply, "U");
+    }
+}
+
+static void cmd_shr(struct mg_str params, struct mbuf *reply)
+{
+    /* Status of HTTP request */
+    /* WARNING: severe caveat in firmware, use SHR sparingly or with more rigourous checking
+       when attempting to detect the HTTP connection state in the middle of a connection!
+       SHR may not respond at all under high CPU load (i.e. during HTTPS operations) */
+    struct ulwi_params cursor;
+    int handle;
+    ulwi_params_init(&cursor, params);
+    if (ulwi_param_handle(&cursor, &handle))
+    {
+        const struct http_response *response = ulwi_http_response(handle);
+        ulwi_reply_printf(reply, "%c", response != NULL ? (char)response->progress : (char)NONEXISTENT);
+        const int position = response != NULL ? ulwi_http_queue_position(response) : 0;
+        if (position > 0)
+        {
+            /* Still waiting for its turn to connect */
+            ulwi_reply_printf(reply, "%s%d", ULWI_DELIMITER, position);
+        }
+        else if (response != NULL && response->progress != IN_PROGRESS && response->cache != 0)
+        {
+            /* Completed from the cache, or by an identical request in flight */
+            ulwi_reply_printf(reply, "%s%c", ULWI_DELIMITER, response->cache);
+        }
+    }
+    else
+    {
+        /* Invalid handle */
+        ulwi_reply_puts(reply, "U");
+    }
+}
+
+static void cmd_ghr(struct mg_str params, struct mbuf *reply)
+{
+    /* Get HTTP request */
+    struct ulwi_params cursor;
+    int handle;
+    char command_type;
+    bool purge;
+    ulwi_params_init(&cursor, params);
+    if (!ulwi_param_handle(&cursor, &handle))
+    {
+        ulwi_reply_puts(reply, "U");
+        return;
+    }
+    if (!ulwi_param_char(&cursor, "SHCM", &command_type) || !ulwi_param_bool(&cursor, &purge))
+    {
+        ulwi_reply_puts(reply, "short");
+        return;
+    }
+    LOG(LL_INFO, ("GHR handle: %d, type: %c, purge: %d", handle, command_type, purge));
+
+    /* Validate the handle again but this time through checking if state is available to read from */
+    if (response_handle_readable(handle) == true)
+    {
+        struct http_response *http_response = ulwi_http_response(handle);
+
+        switch (command_type)
+        {
+        case 'S':
+            /* Get http_response */
+            ulwi_reply_printf(reply, "%i", http_response->status);
+            break;
+        case 'H': {
+            /* Only the headers declared by chr are kept, optionally one by name */
+            struct mg_str name = mg_mk_str_n(NULL, 0);
+            ulwi_param_str(&cursor, &name);
+            ulwi_append_captured(http_response, name, reply);
+            break;
+        }
+        case 'M':
+            /* F if the response reads the same as the one the master last
+               read from this handle, whether or not the server answered 304 */
+            ulwi_reply_puts(reply, ulwi_response_modified(http_response) ? "T" : "F");
+            break;
+        case 'C':
+            /* Get content of the HTTP response, handing the content itself
+               over to the reply when it is about to be purged anyway */
+            if (http_response->spilled > 0)
+            {
+                /* Content is in flash. Reading all of it would need as much heap
+                   as spilling it saved, so only what fits the body budget is
+                   returned, and longer content is left for rhr, even on purge */
+                const int64_t stored = ulwi_response_stored(http_response);
+                if (stored > (int64_t)ulwi_http_body_max())
+                {
+                    ulwi_reply_puts(reply, "U");
+                    return;
+                }
+                ulwi_read_response(http_response, http_response->released, (size_t)stored, reply);
+            }
+            else if (purge && reply->len == 0 && http_response->body != http_response->arena_body)
+            {
+                /* A stream that outgrew the arena is on the heap */
+                mbuf_free(reply);
+                reply->buf = http_response->body;
+                reply->len = http_response->body_len;
+                reply->size = http_response->body_size;
+                http_response->body = http_response->arena_body;
+                http_response->body_len = 0;
+                http_response->body_size = ulwi_http_body_max();
+            }
+            else if (!purge)
+            {
+                /* Queued straight from the body, which http.c detaches from
+                   the transmit queue before it changes */
+                ulwi_reply_borrow(http_response->body, http_response->body_len);
+            }
+            else
+            {
+                /* The handle is deleted before the reply is queued */
+                mbuf_append(reply, http_response->body, http_response->body_len);
+            }
+            break;
+        }
+        if (command_type != 'M')
+        {
+            /* What ghr M compares later responses of the handle against */
+            ulwi_response_mark_read(http_response);
+        }
+
+        /* See whether or not to purge the request */
+        if (purge)
+        {
+            /* Purge said request */
+            ulwi_http_delete(handle);
+        }
+    }
+    else
+    {
+        ulwi_reply_puts(reply, "U");
+    }
+}
+
+static void cmd_dhr(struct mg_str params, struct mbuf *reply)
+{
+    /* Delete HTTP Request */
+    struct ulwi_params cursor;
+    int handle;
+    ulwi_params_init(&cursor, params);
+    if (ulwi_param_handle(&cursor, &handle))
+    {
+        /* Check if handle number is pointing to an populated handle */
+        if (ulwi_http_request(handle) != NULL)
+        {
+            ulwi_http_delete(handle);
+            ulwi_reply_puts(reply, "S");
+        }
+        else
+        {
+            ulwi_reply_puts(reply, "U");
+        }
+    }
+    else
+    {
+        /* Invalid handle */
+        ulwi_reply_puts(reply, "U");
+    }
+}
+
+/* Answers mcg, through its deferred reply slot in pipelining mode, where
+   enabling the client is only answered once the broker accepts or refuses it */
+static void reply_mcg(struct mbuf *reply, int slot, const char *result, bool connecting)
+{
+    if (slot < 0)
+    {
+        ulwi_reply_puts(reply, result);
+    }
+    else if (connecting)
+    {
+        ulwi_mqtt_defer_connect(slot);
+    }
+    else
+    {
+        ulwi_reply_complete(slot, FRAME_CRLF, result, strlen(result));
+    }
+}
+
+static void cmd_mcg(struct mg_str params, struct mbuf *reply)
+{
+    /* MQTT Configure */
+    int slot = -1;
+    if (ulwi_link_tagged() && (slot = ulwi_reply_defer(OPCODE_MCG)) < 0)
+    {
+        ulwi_reply_error(OPCODE_MCG, REPLY_BUSY, FRAME_CRLF);
+        return;
+    }
+    // 5 arguments max, 3 arguments standard
+    struct mg_str result[5];
+    const int param_len = ulwi_split_params(params, result, 5);
+    
+    struct mgos_config_mqtt mqtt_conf = *mgos_sys_config_get_mqtt();
+
+    if (param_len == 1)
+    {
+        /* Enable or disable only */
+        bool enable = result[0].p[0] == 'T'; //TODO: does this need additional sanitisation?
+        if (!enable)
+        {
+            /* Allow disable under any circumstances */
+            mqtt_conf.enable = enable;
+            ulwi_mqtt_unsub_all();
+            ulwi_mqtt_set_config(&mqtt_conf);
+            reply_mcg(reply, slot, "S", false);
+        }
+        else if (mqtt_conf.server != NULL)
+        {
+            /* Enable is true in this if statement, only allow enable if server field is not empty */
+            mqtt_conf.enable = enable;
+            ulwi_mqtt_set_config(&mqtt_conf);
+            reply_mcg(reply, slot, "S", true);
+        }
+        else
+        {
+            /* Cannot enable if server field is empty */
+            reply_mcg(reply, slot, "U", false);
+        }
+    }
+    else if (param_len == 3)
+    {
+        //TODO: add input sanitisation in here
+        const bool enable_tls = result[2].p[0] == 'T' ? true : false;
+        mqtt_conf.enable = result[0].p[0] == 'T' ? true : false;
+        mqtt_conf.server = result[1].p;
+        mqtt_conf.ssl_ca_cert = enable_tls ? "rootca.pem" : NULL;
+        ulwi_mqtt_set_config(&mqtt_conf);
+        reply_mcg(reply, slot, "S", mqtt_conf.enable);
+    }
+    else if (param_len == 5)
+    {
+        const bool enable_tls = result[2].p[0] == 'T' ? true : false;
+        mqtt_conf.enable = result[0].p[0] == 'T' ? true : false;
+        mqtt_conf.server = result[1].p;
+        mqtt_conf.user = result[3].p;
+        mqtt_conf.pass = result[4].p;
+        mqtt_conf.ssl_ca_cert = enable_tls ? "rootca.pem" : NULL;
+        
+        if (ulwi_mqtt_set_config(&mqtt_conf))
+        {
+            if (mgos_mqtt_global_connect())
+            {
+                reply_mcg(reply, slot, "S", mqtt_conf.enable);
+            }
+            else
+            {
+                reply_mcg(reply, slot, "U", false);
+            }
+        }
+        else
+        {
+            reply_mcg(reply, slot, "U", false);
+        }
+    }
+    else
+    {
+        reply_mcg(reply, slot, "invalid", false);
+    }
+}
+
+static void cmd_mic(struct mg_str params, struct mbuf *reply)
+{
+    /* MQTT Is Connected? */
+    if (mgos_mqtt_global_is_connected())
+    {
+        //TODO WARNING: this function returns true even setting MQTT enable to false. will need to investigate further
+        ulwi_reply_puts(reply, "T");
+    }
+    else
+    {
+        ulwi_reply_puts(reply, "F");
+    }
+    (void)params;
+}
+
+static void cmd_msb(struct mg_str params, struct mbuf *reply)
+{
+    /* MQTT Subscribe */
+    // 1 argument
+    struct ulwi_params cursor;
+    struct mg_str topic;
+    ulwi_params_init(&cursor, params);
+    ulwi_param_str(&cursor, &topic);
+    if (!ulwi_mqtt_sub_exists(topic.p))
+    {
+        ulwi_mqtt_sub(topic.p, mqtt_sub_handler, NULL);
+        ulwi_reply_puts(reply, "S");
+    }
+    else ulwi_reply_puts(reply, "U"); /* Subscription already exists */
+}
+
+static void cmd_mus(struct mg_str params, struct mbuf *reply)
+{
+    /* MQTT Unsubscribe */
+    // 1 argument
+    struct ulwi_params cursor;
+    struct mg_str topic;
+    ulwi_params_init(&cursor, params);
+    ulwi_param_str(&cursor, &topic);
+    if (ulwi_mqtt_sub_exists(topic.p))
+    {
+        ulwi_mqtt_unsub((char *)topic.p);
+        ulwi_reply_puts(reply, "S");
+    }
+    else ulwi_reply_puts(reply, "U"); /* Subscription does not exist */
+}
+
+static void cmd_mnd(struct mg_str params, struct mbuf *reply)
+{
+    /* MQTT check subscription for New Data */
+    struct ulwi_params cursor;
+    struct mg_str topic;
+    ulwi_params_init(&cursor, params);
+    ulwi_param_str(&cursor, &topic);
+    if (ulwi_mqtt_sub_exists(topic.p))
+    {
+        ulwi_mqtt_new_data_arrived(topic.p) ? ulwi_reply_puts(reply, "T") : ulwi_reply_puts(reply, "F");
+    }
+    else ulwi_reply_puts(reply, "U"); /* Subscription does not exist */
+}
+
+static void cmd_mgs(struct mg_str params, struct mbuf *reply)
+{
+    /* MQTT Get Subscribed message */
+    struct ulwi_params cursor;
+    struct mg_str topic;
+    ulwi_params_init(&cursor, params);
+    ulwi_param_str(&cursor, &topic);
+    struct mg_str *message = ulwi_mqtt_get_sub_message(topic.p);
+    if (message != NULL)
+    {
+        /* Queued straight from the subscription, which mqtt.c detaches from
+           the transmit queue before it frees the message */
+        ulwi_reply_borrow(message->p, message->len);
+    }
+    else
+    {
+        ulwi_reply_puts(reply, "U"); /* Subscription does not exist */
+    }
+}
+
+static void cmd_mpb(struct mg_str params, struct mbuf *reply)
+{
+    /* MQTT Publish */
+    // 4 arguments
+    struct ulwi_params cursor;
+    struct mg_str topic;
+    struct mg_str content;
+    long qos;
+    bool retain;
+    ulwi_params_init(&cursor, params);
+    if (ulwi_param_str(&cursor, &topic) && ulwi_param_str(&cursor, &content) &&
+        ulwi_param_int(&cursor, 0, 1, &qos) && ulwi_param_bool(&cursor, &retain))
+    {
+        if (mgos_mqtt_pub(topic.p, content.p, content.len, (int)qos, retain))
+        {
+            ulwi_reply_puts(reply, "S");
+        }
+        else
+        {
+            ulwi_reply_puts(reply, "U");
+        }
+    }
+    else
+    {
+        ulwi_reply_puts(reply, "invalid");
+    }
+}
+
+static void cmd_bfm(struct mg_str params, struct mbuf *reply)
+{
+    /* Binary Frame Mode, the switch happens once this reply has been sent */
+    struct ulwi_params cursor;
+    bool enable;
+    ulwi_params_init(&cursor, params);
+    if (ulwi_param_bool(&cursor, &enable))
+    {
+        ulwi_link_request_mode(enable ? LINK_BINARY : LINK_TEXT, ulwi_link_tagged());
+        ulwi_reply_puts(reply, "S");
+    }
+    else
+    {
+        ulwi_reply_puts(reply, "invalid");
+    }
+}
+
+static void cmd_pip(struct mg_str params, struct mbuf *reply)
+{
+    /* PIPelining mode, the switch happens once this reply has been sent */
+    struct ulwi_params cursor;
+    bool enable;
+    ulwi_params_init(&cursor, params);
+    if (ulwi_param_bool(&cursor, &enable))
+    {
+        ulwi_link_request_mode(ulwi_link_mode(), enable);
+        ulwi_reply_puts(reply, "S");
+    }
+    else
+    {
+        ulwi_reply_puts(reply, "invalid");
+    }
+}
+
+static void cmd_sbr(struct mg_str params, struct mbuf *reply)
+{
+    /* Set Baud Rate, the result of the self-test at the new rate is replied later */
+    struct ulwi_params cursor;
+    long baud_rate;
+    bool persist;
+    ulwi_params_init(&cursor, params);
+    if (!ulwi_param_int(&cursor, BAUD_RATE_MIN, BAUD_RATE_MAX, &baud_rate) || !ulwi_param_bool(&cursor, &persist))
+    {
+        ulwi_reply_puts(reply, "invalid");
+        return;
+    }
+    if (ulwi_baud_busy())
+    {
+        ulwi_reply_puts(reply, "U");
+        return;
+    }
+    /* The only reply is the result of the test, so nothing is sent at the old rate once the test starts */
+    const int slot = ulwi_reply_defer(OPCODE_SBR);
+    if (slot < 0)
+    {
+        ulwi_reply_error(OPCODE_SBR, REPLY_BUSY, FRAME_CRLF);
+        return;
+    }
+    ulwi_baud_start((int)baud_rate, persist, slot);
+}
+
+static void cmd_cbr(struct mg_str params, struct mbuf *reply)
+{
+    /* Commit Baud Rate, acknowledges a rate that passed its self-test */
+    ulwi_reply_puts(reply, ulwi_baud_commit() ? "S" : "U");
+    (void)params;
+}
+
+static void cmd_sfc(struct mg_str params, struct mbuf *reply)
+{
+    /* Set Flow Control, which applies from this reply onwards */
+    struct ulwi_params cursor;
+    char mode;
+    long chunk_size = FLOW_CHUNK_MIN;
+    long gap_ms = 0;
+    ulwi_params_init(&cursor, params);
+    if (!ulwi_param_char(&cursor, "NCP", &mode) ||
+        (mode != 'N' && !ulwi_param_int(&cursor, FLOW_CHUNK_MIN, FLOW_CHUNK_MAX, &chunk_size)) ||
+        (mode == 'P' && !ulwi_param_int(&cursor, 1, FLOW_GAP_MAX, &gap_ms)))
+    {
+        ulwi_reply_puts(reply, "invalid");
+        return;
+    }
+    switch (mode)
+    {
+    case 'N':
+        ulwi_txq_set_flow(FLOW_NONE, 0, 0);
+        break;
+    case 'C':
+        ulwi_txq_set_flow(FLOW_CREDIT, chunk_size, 0);
+        break;
+    case 'P':
+        ulwi_txq_set_flow(FLOW_PACED, chunk_size, gap_ms);
+        break;
+    }
+    ulwi_reply_puts(reply, "S");
+}
+
+static void cmd_sen(struct mg_str params, struct mbuf *reply)
+{
+    /* Set Event Notifications, N or any combination of H, M, W and J */
+    uint8_t mask = 0;
+    if (!(params.len == 1 && params.p[0] == 'N'))
+    {
+        for (size_t i = 0; i < params.len; i++)
+        {
+            switch (params.p[i])
+            {
+            case 'H': mask |= EVENT_HTTP; break;
+            case 'M': mask |= EVENT_MQTT; break;
+            case 'W': mask |= EVENT_WIFI; break;
+            case 'J': mask |= EVENT_JOB; break;
+            default:
+                ulwi_reply_puts(reply, "invalid");
+                return;
+            }
+        }
+    }
+    ulwi_event_set_mask(mask);
+    ulwi_reply_puts(reply, "S");
+}
+
+static void cmd_gsr(struct mg_str params, struct mbuf *reply)
+{
+    /* Get Status Register, every subsystem as one bitmap, see ISA.md */
+    struct mbuf bits;
+    mbuf_init(&bits, 0);
+
+    uint8_t system = 0;
+    switch (ulwi_wifi_state())
+    {
+    case 'N': system |= STATUS_WIFI_N; break;
+    case 'P': system |= STATUS_WIFI_P; break;
+    case 'S': system |= STATUS_WIFI_S; break;
+    default:  system |= STATUS_WIFI_U; break;
+    }
+    if (mgos_mqtt_global_is_connected()) system |= STATUS_MQTT_CONNECTED;
+    mbuf_append(&bits, &system, 1);
+
+    /* 2 bits per handle: N=0, P=1, S=2, U=3 */
+    uint8_t byte = 0;
+    const int handles = ulwi_http_handles();
+    for (int handle = 0; handle < handles; handle++)
+    {
+        const struct http_response *response = ulwi_http_response(handle);
+        uint8_t progress;
+        switch (response != NULL ? response->progress : NONEXISTENT)
+        {
+        case IN_PROGRESS: progress = 1; break;
+        case SUCCESS:     progress = 2; system |= STATUS_HTTP_DONE; break;
+        case FAILED:      progress = 3; system |= STATUS_HTTP_DONE; break;
+        default:          progress = 0; break;
+        }
+        byte |= progress << (2 * (handle % 4));
+        if (handle % 4 == 3 || handle == handles - 1)
+        {
+            mbuf_append(&bits, &byte, 1);
+            byte = 0;
+        }
+    }
+
+    if (ulwi_mqtt_append_new_data_bits(&bits)) system |= STATUS_MQTT_NEW_DATA;
+    bits.buf[0] = system;
+
+    if (ulwi_link_mode() == LINK_BINARY)
+    {
+        mbuf_append(reply, bits.buf, bits.len);
+    }
+    else
+    {
+        for (size_t i = 0; i < bits.len; i++)
+        {
+            ulwi_reply_printf(reply, "%02X", (uint8_t)bits.buf[i]);
+        }
+    }
+    mbuf_free(&bits);
+    (void)params;
+}
+
+static void cmd_rhr(struct mg_str params, struct mbuf *reply)
+{
+    /* Read HTTP Response content window, releasing everything before it */
+    struct ulwi_params cursor;
+    int handle;
+    long offset;
+    long length;
+    ulwi_params_init(&cursor, params);
+    if (!ulwi_param_handle(&cursor, &handle) ||
+        !ulwi_param_int(&cursor, 0, 999999999, &offset) ||
+        !ulwi_param_int(&cursor, 1, HTTP_RX_CONTENT_MAX, &length))
+    {
+        ulwi_reply_puts(reply, "invalid");
+        return;
+    }
+    struct http_response *response = ulwi_http_response(handle);
+    if (response == NULL || response->progress == NONEXISTENT || !ulwi_read_response(response, offset, length, reply))
+    {
+        ulwi_reply_puts(reply, "U");
+        return;
+    }
+    ulwi_response_mark_read(response);
+}
+
+static void cmd_qhr(struct mg_str params, struct mbuf *reply)
+{
+    /* Query HTTP Response length, received so far and declared by the server */
+    struct ulwi_params cursor;
+    int handle;
+    ulwi_params_init(&cursor, params);
+    const struct http_response *response;
+    if (!ulwi_param_handle(&cursor, &handle) || (response = ulwi_http_response(handle)) == NULL ||
+        response->progress == NONEXISTENT)
+    {
+        ulwi_reply_puts(reply, "U");
+        return;
+    }
+    ulwi_reply_printf(reply, "%lld%s%lld", (long long)response->written, ULWI_DELIMITER,
+                      (long long)response->content_length);
+}
+
+static void cmd_jhr(struct mg_str params, struct mbuf *reply)
+{
+    /* Get HTTP Response content as JSON: declares the paths to extract before
+       thr, or returns the values extracted once the request is done */
+    struct ulwi_params cursor;
+    int handle;
+    ulwi_params_init(&cursor, params);
+    if (!ulwi_param_handle(&cursor, &handle) || ulwi_http_request(handle) == NULL)
+    {
+        ulwi_reply_puts(reply, "U");
+        return;
+    }
+    struct http_request *request = ulwi_http_request(handle);
+    struct http_response *response = ulwi_http_response(handle);
+
+    if (cursor.next == NULL)
+    {
+        if (response->json == NULL || (response->progress != SUCCESS && response->progress != FAILED) ||
+            ulwi_json_failed(response->json))
+        {
+            ulwi_reply_puts(reply, "U");
+            return;
+        }
+        ulwi_json_append_values(response->json, reply);
+        ulwi_response_mark_read(response);
+        return;
+    }
+
+    if (response->progress == IN_PROGRESS)
+    {
+        ulwi_reply_puts(reply, "U");
+        return;
+    }
+    /* The previous response shares the extractor, whose paths and values are
+       about to be replaced or freed, so its values can no longer be read */
+    response->json = NULL;
+    if (request->json == NULL)
+    {
+        request->json = malloc(sizeof(*request->json));
+        if (request->json == NULL)
+        {
+            ulwi_reply_puts(reply, "U");
+            return;
+        }
+    }
+    request->json->path_count = 0;
+    struct mg_str path;
+    while (ulwi_param_str(&cursor, &path))
+    {
+        if (!ulwi_json_add_path(request->json, path))
+        {
+            free(request->json);
+            request->json = NULL;
+            ulwi_reply_puts(reply, "invalid");
+            return;
+        }
+    }
+    ulwi_reply_puts(reply, "S");
+}
+
+static void cmd_hps(struct mg_str params, struct mbuf *reply)
+{
+    /* HTTP Pool Statistics: reuse counters of the keep-alive pool, or whether
+       the last request of a handle reused a connection */
+    if (params.len == 0)
+    {
+        const struct ulwi_pool_stats *stats = ulwi_pool_get_stats();
+        ulwi_reply_printf(reply, "%u%s%u%s%u%s%u", (unsigned)stats->hits, ULWI_DELIMITER,
+                          (unsigned)stats->misses, ULWI_DELIMITER, (unsigned)stats->evicted,
+                          ULWI_DELIMITER, (unsigned)ulwi_pool_open());
+        return;
+    }
+    struct ulwi_params cursor;
+    int handle;
+    ulwi_params_init(&cursor, params);
+    const struct http_response *response;
+    if (!ulwi_param_handle(&cursor, &handle) || (response = ulwi_http_response(handle)) == NULL ||
+        (response->progress == NONEXISTENT && response->request == NULL))
+    {
+        ulwi_reply_puts(reply, "U");
+        return;
+    }
+    ulwi_reply_puts(reply, response->reused ? "R" : "N");
+}
+
+static void cmd_tsc(struct mg_str params, struct mbuf *reply)
+{
+    /* TLS Session Cache: handshake statistics, persistence across resets, or
+       clearing the cache */
+    if (params.len == 0)
+    {
+        const struct ulwi_tls_stats *stats = ulwi_tls_get_stats();
+        const unsigned full_ms = stats->full > 0 ? (unsigned)(stats->full_micros / stats->full / 1000) : 0;
+        const unsigned resumed_ms = stats->resumed > 0 ? (unsigned)(stats->resumed_micros / stats->resumed / 1000) : 0;
+        ulwi_reply_printf(reply, "%u%s%u%s%u%s%u", (unsigned)stats->full, ULWI_DELIMITER, full_ms,
+                          ULWI_DELIMITER, (unsigned)stats->resumed, ULWI_DELIMITER, resumed_ms);
+        return;
+    }
+    struct ulwi_params cursor;
+    char action;
+    ulwi_params_init(&cursor, params);
+    if (!ulwi_param_char(&cursor, "TFC", &action))
+    {
+        ulwi_reply_puts(reply, "invalid");
+        return;
+    }
+    if (action == 'C')
+    {
+        ulwi_tls_clear();
+        ulwi_reply_puts(reply, "S");
+    }
+    else
+    {
+        ulwi_reply_puts(reply, ulwi_tls_set_persist(action == 'T') ? "S" : "U");
+    }
+}
+
+static void cmd_dns(struct mg_str params, struct mbuf *reply)
+{
+    /* DNS cache: hit and miss counters, or flushing the cache */
+    if (params.len == 0)
+    {
+        const struct ulwi_dns_stats *stats = ulwi_dns_get_stats();
+        ulwi_reply_printf(reply, "%u%s%u%s%u", (unsigned)stats->hits, ULWI_DELIMITER, (unsigned)stats->misses,
+                          ULWI_DELIMITER, (unsigned)ulwi_dns_entries());
+        return;
+    }
+    struct ulwi_params cursor;
+    char action;
+    ulwi_params_init(&cursor, params);
+    if (!ulwi_param_char(&cursor, "F", &action))
+    {
+        ulwi_reply_puts(reply, "invalid");
+        return;
+    }
+    ulwi_dns_flush();
+    ulwi_reply_puts(reply, "S");
+}
+
+static void cmd_chr(struct mg_str params, struct mbuf *reply)
+{
+    /* Capture Headers of HTTP Request: declares the response headers to keep
+       before thr, which ghr H then returns */
+    struct ulwi_params cursor;
+    int handle;
+    ulwi_params_init(&cursor, params);
+    struct http_request *request;
+    if (!ulwi_param_handle(&cursor, &handle) || (request = ulwi_http_request(handle)) == NULL ||
+        ulwi_http_response(handle)->progress == IN_PROGRESS)
+    {
+        ulwi_reply_puts(reply, "U");
+        return;
+    }
+
+    /* The names are stored as the parameter cursor leaves them, NUL delimited */
+    const struct mg_str names = cursor.next != NULL ? mg_mk_str_n(cursor.next, cursor.end - cursor.next)
+                                                    : mg_mk_str_n(NULL, 0);
+    struct mg_str name;
+    int count = 0;
+    while (ulwi_param_str(&cursor, &name))
+    {
+        if (name.len == 0 || name.len > HTTP_CAPTURE_NAME_MAX || ++count > HTTP_CAPTURE_MAX)
+        {
+            ulwi_reply_puts(reply, "invalid");
+            return;
+        }
+    }
+    if (!ulwi_request_set_captures(request, names))
+    {
+        ulwi_reply_puts(reply, "long");
+        return;
+    }
+    ulwi_reply_puts(reply, "S");
+}
+
+static void cmd_hcr(struct mg_str params, struct mbuf *reply)
+{
+    /* HTTP Cache of Responses: statistics, F to flush, or how long the
+       responses of a handle are cached for */
+    if (params.len == 0)
+    {
+        const struct ulwi_cache_stats *stats = ulwi_cache_get_stats();
+        ulwi_reply_printf(reply, "%u%s%u%s%u%s%u%s%u", (unsigned)stats->hits, ULWI_DELIMITER,
+                          (unsigned)stats->misses, ULWI_DELIMITER, (unsigned)stats->coalesced, ULWI_DELIMITER,
+                          (unsigned)ulwi_cache_entries(), ULWI_DELIMITER, (unsigned)ulwi_cache_bytes());
+        return;
+    }
+    if (params.len == 1 && params.p[0] == 'F')
+    {
+        ulwi_cache_flush();
+        ulwi_reply_puts(reply, "S");
+        return;
+    }
+
+    struct ulwi_params cursor;
+    int handle;
+    struct http_request *request;
+    long ttl = HTTP_CACHE_AUTO;
+    ulwi_params_init(&cursor, params);
+    if (!ulwi_param_handle(&cursor, &handle) || (request = ulwi_http_request(handle)) == NULL)
+    {
+        ulwi_reply_puts(reply, "U");
+        return;
+    }
+    /* A for as long as the Cache-Control header of each response allows */
+    if (cursor.next == NULL || (strcmp(cursor.next, "A") != 0 && !ulwi_param_int(&cursor, 0, HTTP_CACHE_TTL_MAX, &ttl)))
+    {
+        ulwi_reply_puts(reply, "invalid");
+        return;
+    }
+    request->cache_ttl = (int32_t)ttl;
+    ulwi_reply_puts(reply, "S");
+}
+
+static void cmd_sjb(struct mg_str params, struct mbuf *reply)
+{
+    /* Schedule JoB: H to transmit a HTTP handle or M to publish an MQTT
+       message every interval, or just the job to remove it */
+    struct ulwi_params cursor;
+    long job;
+    char kind;
+    long interval;
+    ulwi_params_init(&cursor, params);
+    if (!ulwi_param_int(&cursor, 0, JOBS_MAX - 1, &job))
+    {
+        ulwi_reply_puts(reply, "invalid");
+        return;
+    }
+    if (cursor.next == NULL)
+    {
+        ulwi_job_remove((int)job);
+        ulwi_reply_puts(reply, "S");
+        return;
+    }
+    if (!ulwi_param_char(&cursor, "HM", &kind) ||
+        !ulwi_param_int(&cursor, JOB_INTERVAL_MIN, JOB_INTERVAL_MAX, &interval))
+    {
+        ulwi_reply_puts(reply, "invalid");
+        return;
+    }
+
+    bool scheduled;
+    if (kind == 'H')
+    {
+        int handle;
+        if (!ulwi_param_handle(&cursor, &handle))
+        {
+            ulwi_reply_puts(reply, "invalid");
+            return;
+        }
+        scheduled = ulwi_job_set_http((int)job, (unsigned int)interval, handle);
+    }
+    else
+    {
+        struct mg_str topic;
+        struct mg_str message;
+        long qos;
+        bool retain;
+        if (!ulwi_param_str(&cursor, &topic) || !ulwi_param_str(&cursor, &message) ||
+            !ulwi_param_int(&cursor, 0, 1, &qos) || !ulwi_param_bool(&cursor, &retain) ||
+            topic.len == 0 || topic.len > JOB_TOPIC_MAX || message.len > JOB_MESSAGE_MAX)
+        {
+            ulwi_reply_puts(reply, "invalid");
+            return;
+        }
+        scheduled = ulwi_job_set_mqtt((int)job, (unsigned int)interval, topic, message, (int)qos, retain);
+    }
+    ulwi_reply_puts(reply, scheduled ? "S" : "U");
+}
+
+static void cmd_gjb(struct mg_str params, struct mbuf *reply)
+{
+    /* Get JoB: the change flags of every job, or the result of one */
+    if (params.len == 0)
+    {
+        ulwi_job_append_changed(reply);
+        return;
+    }
+    struct ulwi_params cursor;
+    long job;
+    ulwi_params_init(&cursor, params);
+    if (!ulwi_param_int(&cursor, 0, JOBS_MAX - 1, &job) || !ulwi_job_read((int)job, reply))
+    {
+        ulwi_reply_puts(reply, "U");
+    }
+}
+
+static void cmd_ahr(struct mg_str params, struct mbuf *reply)
+{
+    /* Append to HTTP Request: a chunk of a chunked POST body, C for more to
+       come or E for the last. The chunk is the rest of the line, delimiters
+       included. */
+    struct ulwi_params cursor;
+    int handle;
+    char kind;
+    ulwi_params_init(&cursor, params);
+    if (!ulwi_param_handle(&cursor, &handle))
+    {
+        ulwi_reply_puts(reply, "U");
+        return;
+    }
+    if (!ulwi_param_char(&cursor, "CE", &kind))
+    {
+        ulwi_reply_puts(reply, "short");
+        return;
+    }
+    const struct mg_str data = cursor.next != NULL ? mg_mk_str_n(cursor.next, cursor.end - cursor.next)
+                                                   : mg_mk_str_n(NULL, 0);
+    switch (ulwi_http_append_body(handle, data, kind == 'E'))
+    {
+    case APPEND_DONE:
+        ulwi_reply_puts(reply, "S");
+        break;
+    case APPEND_FULL:
+        /* Sent again by the master once the window has drained */
+        ulwi_reply_puts(reply, "busy");
+        break;
+    case APPEND_INVALID:
+        ulwi_reply_puts(reply, "U");
+        break;
+    }
+}
+
+static void cmd_lst(struct mg_str params, struct mbuf *reply)
+{
+    /* Link STatistics: T for the counters of the UART transmit queue, R for
+       those of command dispatch */
+    struct ulwi_params cursor;
+    char kind;
+    ulwi_params_init(&cursor, params);
+    if (!ulwi_param_char(&cursor, "TR", &kind))
+    {
+        ulwi_reply_puts(reply, "invalid");
+        return;
+    }
+    if (kind == 'R')
+    {
+        ulwi_reply_printf(reply, "%lu%s%lu%s%lu%s%u%s%u", (unsigned long)dispatch_stats.wakeups, ULWI_DELIMITER,
+                          (unsigned long)dispatch_stats.lines, ULWI_DELIMITER,
+                          (unsigned long)dispatch_stats.budget_exhausted, ULWI_DELIMITER,
+                          (unsigned)dispatch_stats.last_lines, ULWI_DELIMITER, (unsigned)dispatch_stats.max_lines);
+        return;
+    }
+    const struct ulwi_txq_stats *tx_stats = ulwi_txq_get_stats();
+    ulwi_reply_printf(reply, "%u%s%u%s%lu%s%lu%s%lu%s%lu", (unsigned)tx_stats->depth, ULWI_DELIMITER,
+                      (unsigned)tx_stats->max_depth, ULWI_DELIMITER, (unsigned long)tx_stats->stalls,
+                      ULWI_DELIMITER, (unsigned long)(tx_stats->stall_micros / 1000), ULWI_DELIMITER,
+                      (unsigned long)tx_stats->flushes, ULWI_DELIMITER, (unsigned long)tx_stats->grants);
+}
+
+/* Signature shared by every command handler */
+typedef void (*ulwi_command_handler)(struct mg_str params, struct mbuf *reply);
+
+struct ulwi_command
+{
+    ulwi_command_handler handler;   /* Handler of the command, NULL if it is not implemented yet */
+    size_t min_len;                 /* Minimum length (inclusive) of the parameters */
+    size_t max_len;                 /* Maximum length (inclusive) of the parameters, 0 if none are taken */
+    enum reply_framing framing;     /* How replies of this command are delimited in text mode */
+};
+
+/* Command table, indexed by enum ulwi_opcode. Commands that take no
+   parameters reply "invalid" when given any, the rest reply "short" or
+   "long" when their parameters are out of bounds */
+static const struct ulwi_command command_table[OPCODE_COUNT] = {
+    [OPCODE_NOP] = { cmd_nop, 0, 0, FRAME_CRLF },
+    [OPCODE_VER] = { cmd_ver, 0, 0, FRAME_CRLF },
+    [OPCODE_RST] = { cmd_rst, 0, 0, FRAME_NONE },
+    [OPCODE_OTA] = { NULL, 0, 0, FRAME_CRLF },
+    [OPCODE_LAP] = { cmd_lap, 0, 0, FRAME_NONE },
+    [OPCODE_CAP] = { cmd_cap, 1, 255, FRAME_CRLF },
+    [OPCODE_SAP] = { cmd_sap, 0, 0, FRAME_CRLF },
+    [OPCODE_DAP] = { cmd_dap, 0, 0, FRAME_NONE },
+    [OPCODE_GIP] = { cmd_gip, 0, 0, FRAME_CRLF },
+    [OPCODE_IHR] = { cmd_ihr, 0, 258, FRAME_CRLF },
+    [OPCODE_PHR] = { cmd_phr, 1, HTTP_HANDLE_DIGITS + 1 + HTTP_TX_CONTENT_MAX, FRAME_CRLF },
+    [OPCODE_HHR] = { cmd_hhr, 1, HTTP_HANDLE_DIGITS + 1 + HTTP_TX_CONTENT_MAX, FRAME_CRLF },
+    [OPCODE_THR] = { cmd_thr, 1, HTTP_HANDLE_DIGITS + 4, FRAME_CRLF },
+    [OPCODE_SHR] = { cmd_shr, 1, HTTP_HANDLE_DIGITS, FRAME_CRLF },
+    [OPCODE_GHR] = { cmd_ghr, 5, HTTP_HANDLE_DIGITS + 5 + HTTP_CAPTURE_NAME_MAX, FRAME_XON_1 },
+    [OPCODE_DHR] = { cmd_dhr, 1, HTTP_HANDLE_DIGITS, FRAME_CRLF },
+    [OPCODE_MCG] = { cmd_mcg, 1, 320, FRAME_CRLF },
+    [OPCODE_MIC] = { cmd_mic, 0, 0, FRAME_CRLF },
+    [OPCODE_MSB] = { cmd_msb, 1, 127, FRAME_CRLF },
+    [OPCODE_MUS] = { cmd_mus, 1, 127, FRAME_CRLF },
+    [OPCODE_MND] = { cmd_mnd, 1, 127, FRAME_CRLF },
+    [OPCODE_MGS] = { cmd_mgs, 1, 127, FRAME_XON_1 },
+    [OPCODE_MPB] = { cmd_mpb, 1, 255, FRAME_CRLF },
+    [OPCODE_BFM] = { cmd_bfm, 1, 1, FRAME_CRLF },
+    [OPCODE_PIP] = { cmd_pip, 1, 1, FRAME_CRLF },
+    [OPCODE_SBR] = { cmd_sbr, 6, 8, FRAME_CRLF },
+    [OPCODE_CBR] = { cmd_cbr, 0, 0, FRAME_CRLF },
+    [OPCODE_SFC] = { cmd_sfc, 1, 11, FRAME_CRLF },
+    [OPCODE_SEN] = { cmd_sen, 1, 3, FRAME_CRLF },
+    [OPCODE_GSR] = { cmd_gsr, 0, 0, FRAME_CRLF },
+    [OPCODE_RHR] = { cmd_rhr, 5, HTTP_HANDLE_DIGITS + 14, FRAME_XON_1 },
+    [OPCODE_QHR] = { cmd_qhr, 1, HTTP_HANDLE_DIGITS, FRAME_CRLF },
+    [OPCODE_JHR] = { cmd_jhr, 1, HTTP_HANDLE_DIGITS + JSON_PATHS_MAX * JSON_PATH_MAX, FRAME_XON_1 },
+    [OPCODE_HPS] = { cmd_hps, 0, HTTP_HANDLE_DIGITS, FRAME_CRLF },
+    [OPCODE_TSC] = { cmd_tsc, 0, 1, FRAME_CRLF },
+    [OPCODE_DNS] = { cmd_dns, 0, 1, FRAME_CRLF },
+    [OPCODE_CHR] = { cmd_chr, 1, HTTP_HANDLE_DIGITS + HTTP_CAPTURE_MAX * (HTTP_CAPTURE_NAME_MAX + 1), FRAME_CRLF },
+    [OPCODE_SJB] = { cmd_sjb, 1, 15 + JOB_TOPIC_MAX + JOB_MESSAGE_MAX, FRAME_CRLF },
+    [OPCODE_GJB] = { cmd_gjb, 0, 3, FRAME_CRLF },
+    [OPCODE_HCR] = { cmd_hcr, 0, HTTP_HANDLE_DIGITS + 6, FRAME_CRLF },
+    [OPCODE_AHR] = { cmd_ahr, 3, HTTP_HANDLE_DIGITS + 3 + HTTP_TX_CONTENT_MAX, FRAME_CRLF },
+    [OPCODE_LST] = { cmd_lst, 1, 1, FRAME_CRLF },
+};
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: dispatch_command                                            *
+ *                                                                            *
+ * PURPOSE: Validates the parameters of a decoded command against the command *
+ *          table, runs the handler and sends the framed reply. Shared by the *
+ *          text and binary modes of the UART link.                           *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE         I/O DESCRIPTION                                      *
+ * -------- ------------ --- -----------                                      *
+ * opcode   ulwi_opcode   I  The decoded command, may be out of range         *
+ * params   mg_str        I  The parameters of the command, null terminated   *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+static void dispatch_command(enum ulwi_opcode opcode, struct mg_str params)
+{
+    if (opcode >= OPCODE_COUNT || command_table[opcode].handler == NULL)
+    {
+        ulwi_reply_error(OPCODE_INVALID, REPLY_INVALID, FRAME_CRLF);
+        return;
+    }
+    const struct ulwi_command *command = &command_table[opcode];
+    /* Replies to malformed commands carry the framing of the command itself */
+    const enum reply_framing error_framing = command->framing == FRAME_XON_1 ? FRAME_XON_1 : FRAME_CRLF;
+
+    /* Validate the length declared for this command */
+    const enum str_len_state str_state = ulwi_validate_strlen(params.len, command->min_len, command->max_len);
+    if (str_state != STRING_OK && command->max_len == 0)
+    {
+        /* Commands without parameters must match exactly */
+        ulwi_reply_error(opcode, REPLY_INVALID, FRAME_CRLF);
+        return;
+    }
+    else if (str_state == STRING_LONG)
+    {
+        ulwi_reply_error(opcode, REPLY_LONG, error_framing);
+        return;
+    }
+    else if (str_state == STRING_SHORT)
+    {
+        ulwi_reply_error(opcode, REPLY_SHORT, error_framing);
+        return;
+    }
+
+    /* Run the handler and frame whatever it replied with */
+    struct mbuf reply;
+    mbuf_init(&reply, 0);
+    command->handler(params, &reply);
+    ulwi_reply_send(opcode, command->framing, &reply);
+    mbuf_free(&reply);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: dispatch_line                                               *
+ *                                                                            *
+ * PURPOSE: Decodes a single text mode command line and dispatches it. In     *
+ *          pipelining mode the line starts with a 1 character sequence tag.  *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE    I/O DESCRIPTION                                           *
+ * -------- ------- --- -----------                                           *
+ * line     mg_str   I  The full command line, null terminated, without CRLF  *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+static void dispatch_line(struct mg_str line)
+{
+    /* Phase I: in pipelining mode the first character is the sequence tag */
+    if (ulwi_link_tagged())
+    {
+        if (line.len < 1)
+        {
+            ulwi_reply_set_tag('\0');
+            ulwi_reply_error(OPCODE_INVALID, REPLY_SHORT, FRAME_CRLF);
+            return;
+        }
+        ulwi_reply_set_tag(line.p[0]);
+        line.p++;
+        line.len--;
+    }
+
+    /* Phase II: basic command sanitisation */
+    if (line.len < 3)
+    {
+        ulwi_reply_error(OPCODE_INVALID, REPLY_SHORT, FRAME_CRLF);
+        return;
+    }
+
+    /* Phase III: decode the mnemonic straight into the command table */
+    const enum ulwi_opcode opcode = ulwi_decode_opcode(line);
+
+    /* Phase IV: the parameters follow the mnemonic and a space. A line that
+       is exactly the mnemonic has no parameters, and the null terminator at
+       its end doubles as the empty parameter string */
+    struct mg_str params = mg_mk_str_n(line.p + line.len, 0);
+    if (line.len > 3)
+    {
+        if (opcode < OPCODE_COUNT && command_table[opcode].max_len == 0)
+        {
+            /* Commands without parameters must match exactly */
+            ulwi_reply_error(opcode, REPLY_INVALID, FRAME_CRLF);
+            return;
+        }
+        params = mg_mk_str_n(line.p + 4, line.len > 4 ? line.len - 4 : 0);
+    }
+    dispatch_command(opcode, params);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: receive_binary_frame                                        *
+ *                                                                            *
+ * PURPOSE: Parses one binary frame at the start of the current receive       *
+ *          position: 1 byte opcode, varint payload length, payload and a     *
+ *          big endian CRC-16 over everything before it. In pipelining mode   *
+ *          the first payload byte is the sequence tag. The payload is null   *
+ *          terminated in place over the CRC once it has been verified, and   *
+ *          its length prefixed parameters are unframed in place. On a        *
+ *          bad length or CRC one error is replied and bytes are dropped one  *
+ *          at a time until a valid frame is found again.                     *
+ *                                                                            *
+ * ARGUMENTS: none                                                            *
+ *                                                                            *
+ * RETURNS: true if a frame was dispatched or a byte dropped, false if more   *
+ *          input is needed                                                   *
+ *                                                                            *
+ *****************************************************************************/
+static bool receive_binary_frame(void)
+{
+    const uint8_t *frame = (const uint8_t *)rx.buf + rx.line_start;
+    const size_t available = rx.len - rx.line_start;
+    uint32_t payload_len = 0;
+
+    const int varint_len = available > 1 ? ulwi_varint_decode(frame + 1, available - 1, &payload_len) : 0;
+    if (varint_len == 0)
+    {
+        /* Header is incomplete, wait for more input */
+        rx.scanned = rx.len;
+        return false;
+    }
+
+    const size_t body_len = 1 + varint_len + payload_len;
+    bool valid = varint_len > 0 && payload_len <= UART_RX_LINE_MAX;
+    if (valid && available < body_len + 2)
+    {
+        /* Payload or CRC is incomplete, wait for more input */
+        rx.scanned = rx.len;
+        return false;
+    }
+    if (valid)
+    {
+        const uint16_t crc = (frame[body_len] << 8) | frame[body_len + 1];
+        valid = ulwi_crc16(ULWI_CRC16_INIT, frame, body_len) == crc;
+        if (!valid && !rx.discarding)
+        {
+            ulwi_reply_error(frame[0], REPLY_CRC, FRAME_CRLF);
+        }
+    }
+    else if (!rx.discarding)
+    {
+        ulwi_reply_error(frame[0], REPLY_LONG, FRAME_CRLF);
+    }
+
+    if (!valid)
+    {
+        /* Hunt for the start of the next valid frame */
+        rx.discarding = true;
+        rx.line_start++;
+        rx.scanned = rx.line_start;
+        return true;
+    }
+
+    rx.discarding = false;
+    const enum ulwi_opcode opcode = (enum ulwi_opcode)frame[0];
+    char *payload = rx.buf + rx.line_start + 1 + varint_len;
+    payload[payload_len] = '\0';
+    rx.line_start += body_len + 2;
+    rx.scanned = rx.line_start;
+
+    /* In pipelining mode the first payload byte is the sequence tag */
+    if (ulwi_link_tagged())
+    {
+        if (payload_len < 1)
+        {
+            ulwi_reply_set_tag('\0');
+            ulwi_reply_error(opcode, REPLY_SHORT, FRAME_CRLF);
+            return true;
+        }
+        ulwi_reply_set_tag(payload[0]);
+        payload++;
+        payload_len--;
+    }
+    size_t params_len = payload_len;
+    if (!ulwi_params_unframe(payload, &params_len))
+    {
+        ulwi_reply_error(opcode, REPLY_INVALID, FRAME_CRLF);
+        return true;
+    }
+    dispatch_command(opcode, mg_mk_str_n(payload, params_len));
+    ulwi_params_end_frame();
+    return true;
+}
+
 /******************************************************************************
  *                                                                            *
  * FUNCTION NAME: uart_dispatcher                                             *
@@ -90,845 +1595,267 @@ static struct http_response response_array[HTTP_HANDLES_MAX];
  *****************************************************************************/
 static void uart_dispatcher(int uart_no, void *arg)
 {
-    /* Phase 1: allocate buffer */
-    static struct mbuf buffer = {0}; /* Make an empty mbuf (memory buffer) struct */
-    assert(uart_no == UART_NO);      /* Just to make sure that we're reading on the correct UART */
+    assert(uart_no == UART_NO); /* Just to make sure that we're reading on the correct UART */
 
-    /* Phase 2: Check input size, return if size is 0 */
-    size_t available_size = mgos_uart_read_avail(uart_no);
-    if (available_size == 0)
-    {
-        return;
-    }
+    /* The dispatcher also runs when the UART has space to transmit, so
+       continue sending whatever replies are still queued */
+    ulwi_txq_drain();
 
-    /* Phase 3: Read input into buffer and appropriately terminate the line */
-    mgos_uart_read_mbuf(uart_no, &buffer, available_size);
-    /* Retrieve pointer of the last character, in this case it's the CR character */
-    char *line_ending = (char *)mg_strchr(mg_mk_str_n(buffer.buf, buffer.len), '\r');
-    if (line_ending == NULL)
-    {
-        /* Unable to find newline or line termination, ignoring input */
-        return;
-    }
-    if (*(line_ending + 1) != '\n')
+    /* Input during a baud rate self-test is the echoed pattern, not commands */
+    if (ulwi_baud_consume(uart_no))
     {
-        /* Check if the next character in sequence is NL which is a full
-           modern Windows style CRLF (\r\n) */
-        /* CAVEAT: This will cause any input containing \r only to be ignored */
         return;
     }
-    *(line_ending + 1) = '\0'; /* Null terminate the string, replacing NL (NOT CR!) with NULL */
-    size_t line_length = line_ending + 1 - buffer.buf;
-    /* Creates an mg_str (basically a string) from buffer.buf (which is a C array) */
-    struct mg_str line = MG_MK_STR_N(buffer.buf, line_length);
-    /* Manually strip CR from line after NL is processed as the termination character */
-    /* This is to fully flush the serial buffer */
-    *line_ending = '\0';
-    line.len--;
 
-    /* Now we can process the line itself, because we've null terminated the
-     * line correctly (it's a C string now) and removed newline characters */
-
-    /* Phase I: basic command sanitisation */
-    // LOG(LL_INFO, ("input length: %d, input: %s", line.len, line.p));
-    if (line.len < 3)
-    {
-        mgos_uart_printf(UART_NO, "short\r\n");
-    }
-    else
+    /* Phase 1: Read as much input as fits into the receive buffer. There may be
+       nothing new if this is a rescheduled pass to drain lines left over by
+       the budget, and anything that does not fit stays in the UART driver */
+    size_t available_size = mgos_uart_read_avail(uart_no);
+    size_t space = UART_RX_BUF_SIZE - rx.len;
+    if (available_size > 0 && space > 0)
     {
-        /* Phase II: string comparison to sort out the commands */
-        if (mg_str_starts_with(line, COMMAND_NOP) && line.len == 3)
-        {
-            /* No Operation */
-            mgos_uart_printf(UART_NO, "\r\n");
-        }
-        else if (mg_str_starts_with(line, COMMAND_VER) && line.len == 3)
-        {
-            /* Print Version */
-            mgos_uart_printf(UART_NO, "%s\r\n", mgos_sys_config_get_version());
-        }
-        else if (mg_str_starts_with(line, COMMAND_RST) && line.len == 3)
-        {
-            /* Reset device */
-            mgos_system_restart();
-        }
-        else if (mg_str_starts_with(line, COMMAND_LAP) && line.len == 3)
-        {
-            /* List Access Points */
-            /* We need to ensure that Wi-Fi radio is enabled, even temporarily,
-               for this purpose */
-            float rand = mgos_rand_range(0.0f, 100.0f);
-            char buf[10];
-            snprintf(buf, 10, "%f", rand);
-            const struct mgos_config_wifi_ap ap_config = 
-            { 
-                .enable = true,
-                .ssid = buf,
-                .dhcp_start = "10.1.0.2",
-                .dhcp_end = "10.1.0.9",
-                .ip = "10.1.0.1",
-                .netmask = "255.255.255.0",
-                .gw = "10.1.0.1",
-                .hidden = true
-            };
-            mgos_wifi_setup_ap(&ap_config);
-            mgos_wifi_scan(wifi_scan_cb, NULL);
-        }
-        else if (mg_str_starts_with(line, COMMAND_CAP))
-        {
-            /* Connect to Access Point */
-            const size_t min_len = 4;               /* 3 for command, 1 space */
-            const size_t max_len = min_len + 255;
-            const enum str_len_state str_state = ulwi_validate_strlen(line.len, min_len, max_len);
-            if (str_state == STRING_OK)
-            {
-                char parameter_c_str[256] = {0};
-                ulwi_cpy_params_only(parameter_c_str, line.p, line.len);
-
-                const int max_params = 5;
-                const int max_param_len = 65;
-                char result[max_params][max_param_len];
-
-                const int param_len = split_parameter_string(parameter_c_str, max_params, max_param_len, result);
-                
-                if (param_len == 2)
-                {
-                    const struct mgos_config_wifi_sta wifi_config = 
-                    { 
-                        .enable = true, 
-                        .ssid = result[0],
-                        .pass = result[1]
-                    };
-                    mgos_wifi_setup_sta(&wifi_config);
-                    mgos_uart_printf(UART_NO, "\r\n");
-                }
-                else if (param_len == 3)
-                {
-                    const struct mgos_config_wifi_sta wifi_config = 
-                    { 
-                        .enable = true, 
-                        .ssid = result[0],
-                        .user = result[1],
-                        .pass = result[2]
-                    };
-                    mgos_wifi_setup_sta(&wifi_config);
-                    mgos_uart_printf(UART_NO, "\r\n");
-                }
-                else if (param_len == 5)
-                {
-                    const struct mgos_config_wifi_sta wifi_config = 
-                    { 
-                        .enable = true,
-                        .ssid = result[0],
-                        .pass = result[1],
-                        .ip = result[2],
-                        .gw = result[3],
-                        .netmask = result[4]
-                    };
-                    mgos_wifi_setup_sta(&wifi_config);
-                    mgos_uart_printf(UART_NO, "\r\n");
-                }
-                else
-                {
-                    mgos_uart_printf(UART_NO, "invalid\r\n");
-                }
-            }
-            else if (str_state == STRING_LONG)
-            {
-                mgos_uart_printf(UART_NO, "long\r\n");
-            }
-            else if (str_state == STRING_SHORT)
-            {
-                mgos_uart_printf(UART_NO, "short\r\n");
-            }
-        }
-        else if (mg_str_starts_with(line, COMMAND_SAP) && line.len == 3)
-        {
-            /* Status of Access Point */
-            const enum mgos_wifi_status wifi_status = mgos_wifi_get_status();
-            char *ssid = mgos_wifi_get_connected_ssid();
-            switch (wifi_status)
-            {
-            case MGOS_WIFI_DISCONNECTED:
-                mgos_uart_printf(UART_NO, "N\r\n");
-                break;
-            case MGOS_WIFI_CONNECTING:
-                mgos_uart_printf(UART_NO, "P\r\n");
-                break;
-            case MGOS_WIFI_CONNECTED:
-                /* TODO: need to implement differentiation between connected and IP acquired,
-                         as some Wi-Fi environments do NOT use DHCP */
-                /* this condition is fallthrough */
-            case MGOS_WIFI_IP_ACQUIRED:
-                if (ssid)
-                {
-                    mgos_uart_printf(UART_NO, "S\r\n");
-                }
-                else
-                {
-                    /* This case occurs when Wi-Fi connection was JUST established and
-                       might not constitute an error */
-                    mgos_uart_printf(UART_NO, "P\r\n", ssid);
-                    LOG(LL_DEBUG, ("Wifi IP acquired but SSID is null"));
-                }
-                break;
-            default:
-                mgos_uart_printf(UART_NO, "U\r\n");
-                break;
-            }
-            free(ssid);
-        }
-        else if (mg_str_starts_with(line, COMMAND_DAP) && line.len == 3)
-        {
-            /* Disconnect from Access Point */
-            const char *ssid = mgos_wifi_get_connected_ssid();
-            if (ssid)
-            {
-                LOG(LL_DEBUG, ("attempting disconnect from wifi"));
-                const struct mgos_config_wifi_sta wifi_config = { false };
-                mgos_wifi_setup_sta(&wifi_config);
-            }
-            else
-            {
-                LOG(LL_DEBUG, ("not attempting disconnect from wifi"));
-            }
-        }
-        else if (mg_str_starts_with(line, COMMAND_GIP) && line.len == 3)
-        {
-            /* Get IP */
-            struct mgos_net_ip_info ip_information;
-            mgos_net_get_ip_info(MGOS_NET_IF_TYPE_WIFI, MGOS_NET_IF_WIFI_STA, &ip_information);
-            char ip[16];
-            mgos_net_ip_to_str(&ip_information.ip, ip);
-            mgos_uart_printf(UART_NO, "%s\r\n", ip);
-        }
-        else if (mg_str_starts_with(line, COMMAND_IHR))
-        {
-            /* Initialise HTTP Request */
-            const int max_param_count = 2;
-            const size_t min_len = 4;
-            const size_t max_len = min_len + 258;
-            const enum str_len_state str_state = ulwi_validate_strlen(line.len, min_len, max_len);
-            if (str_state == STRING_OK)
-            {
-                char parameter_c_str[258] = {0}; /* 1 (Get/Post) + 255 (URL length) + 2 null termination */
-                ulwi_cpy_params_only(parameter_c_str, line.p, line.len);
-
-                const int handle = get_available_handle(http_array); /* Returns -1 if no handle available */
-
-                if (handle != -1)
-                {
-                    struct http_request *request = &http_array[handle];
-                    struct http_response *response = &response_array[handle];
-
-                    char *token = strtok(parameter_c_str, ULWI_DELIMITER);
-                    int param_counter = 0;
-                    while (token != NULL && param_counter < max_param_count)
-                    {
-                        switch (param_counter)
-                        {
-                        case 0:
-                            request->method = token[0];
-                            break;
-                        case 1:
-                            request->url = mg_strdup_nul(mg_mk_str(token));
-                            break;
-                        }
-                        token = strtok(NULL, ULWI_DELIMITER);
-                        param_counter++;
-                    }
-
-                    if (param_counter == max_param_count)
-                    {
-                        /* Ensure that the relevant http_response struct is empty before finishing */
-                        ulwi_empty_response(response);
-                        mgos_uart_printf(UART_NO, "%i\r\n", handle);
-                        LOG(LL_INFO, ("request type: %c, url: %s", request->method, request->url.p));
-                    }
-                    else
-                    {
-                        /* Reset request if there are not enough parameters given,
-                        reason being that the request is filled before checking
-                        for max parameter count */
-                        ulwi_empty_request(request);
-                        mgos_uart_printf(UART_NO, "short\r\n");
-                    }
-                }
-                else
-                {
-                    /* Failed to create handle, most likely it ran out */
-                    mgos_uart_printf(UART_NO, "U\r\n");
-                }
-            }
-            else if (str_state == STRING_LONG)
-            {
-                mgos_uart_printf(UART_NO, "long\r\n");
-            }
-            else if (str_state == STRING_SHORT)
-            {
-                mgos_uart_printf(UART_NO, "short\r\n");
-            }
-        }
-        else if (mg_str_starts_with(line, COMMAND_PHR) && line.len > 4)
-        {
-            /* Parameter of HTTP request */
-            insert_field_http_request(POST_FIELD, &line, http_array);
-        }
-        else if (mg_str_starts_with(line, COMMAND_HHR) && line.len > 4)
-        {
-            /* Header of HTTP request */
-            insert_field_http_request(HEADER, &line, http_array);
-        }
-        else if (mg_str_starts_with(line, COMMAND_THR))
+        const size_t read_start = rx.len;
+        rx.len += mgos_uart_read(uart_no, rx.buf + rx.len, available_size < space ? available_size : space);
+        if (ulwi_txq_flow() == FLOW_CREDIT && ulwi_link_mode() == LINK_TEXT)
         {
-            /* Transmit HTTP request */
-            const enum str_len_state str_state = ulwi_validate_strlen(line.len, 5, 5);
-            if (str_state == STRING_OK)
+            /* Credit grants never appear in text commands, take them out of
+               the input wherever they are */
+            size_t kept = read_start;
+            for (size_t i = read_start; i < rx.len; i++)
             {
-                char parameter_c_str[2] = {0};
-                ulwi_cpy_params_only(parameter_c_str, line.p, line.len);
-
-                const int handle = validate_handle_string(parameter_c_str);
-                if (handle >= 0)
+                if ((uint8_t)rx.buf[i] == CREDIT_GRANT)
                 {
-                    struct http_request *request = &http_array[handle];
-                    struct http_response *response = &response_array[handle];
-
-                    /* Check if handle refers to a null by checking the method char for the null char */
-                    if (request->method)
-                    {
-                        /* Clear the previous response */
-                        ulwi_empty_response(response);
-                        char *headers = NULL;
-                        if (request->headers.len > 0)
-                        {
-                            headers = (char *)request->headers.p;
-                        }
-                        if (request->method == 'G')
-                        {
-                            LOG(LL_INFO, ("GET HTTP url: %s", request->url.p));
-                            mg_connect_http(mgos_get_mgr(), &ev_handler, response, request->url.p, headers, NULL);
-                            mgos_uart_printf(UART_NO, "S\r\n");
-                        }
-                        else if (request->method == 'P')
-                        {
-                            if (request->post_field.len > 0)
-                            {
-                                LOG(LL_INFO, ("POST HTTP url: %s, data: %s", request->url.p, request->post_field.p));
-                                mg_connect_http(mgos_get_mgr(), &ev_handler, response, request->url.p, headers, request->post_field.p);
-                                mgos_uart_printf(UART_NO, "S\r\n");
-                            }
-                            else
-                            {
-                                /* TODO: Check if the behavior of this condition actually even performs POST, since an empty string
-                                   is effectively \0 (which, while different from a NULL, which is a pointer, may be the same
-                                   thing depending on the system) */
-                                LOG(LL_INFO, ("POST HTTP url: %s", request->url.p));
-                                mg_connect_http(mgos_get_mgr(), &ev_handler, response, request->url.p, headers, "");
-                                mgos_uart_printf(UART_NO, "S\r\n");
-                            }
-                        }
-                    }
-                    else
-                    {
-                        mgos_uart_printf(UART_NO, "U\r\n");
-                    }
+                    ulwi_txq_grant();
                 }
                 else
                 {
-                    /* Invalid handle */
-                    mgos_uart_printf(UART_NO, "U\r\n");
+                    rx.buf[kept++] = rx.buf[i];
                 }
             }
-            else if (str_state == STRING_LONG)
-            {
-                mgos_uart_printf(UART_NO, "long\r\n");
-            }
-            else if (str_state == STRING_SHORT)
-            {
-                mgos_uart_printf(UART_NO, "short\r\n");
-            }
+            rx.len = kept;
         }
-        else if (mg_str_starts_with(line, COMMAND_SHR))
-        {
-            /* Status of HTTP request */
-            /* WARNING: severe caveat in firmware, use SHR sparingly or with more rigourous checking
-               when attempting to detect the HTTP connection state in the middle of a connection!
-               SHR may not respond at all under high CPU load (i.e. during HTTPS operations) */
-            const enum str_len_state str_state = ulwi_validate_strlen(line.len, 5, 5);
-            if (str_state == STRING_OK)
-            {
-                char parameter_c_str[2] = {0};
-                ulwi_cpy_params_only(parameter_c_str, line.p, line.len);
+    }
 
-                const int handle = validate_handle_string(parameter_c_str);
-                if (handle >= 0)
-                {
-                    struct http_response *response = &response_array[handle];
-                    // mgos_uart_write(UART_NO, XON_2, 1);
-                    mgos_uart_printf(UART_NO, "%c\r\n", (char)response->progress);
-                    // mgos_uart_write(UART_NO, XOFF_2, 1);
-                }
-                else
-                {
-                    /* Invalid handle */
-                    // mgos_uart_write(UART_NO, XON_2, 1);
-                    mgos_uart_printf(UART_NO, "U\r\n");
-                    // mgos_uart_write(UART_NO, XOFF_2, 1);
-                }  
-            }
-            else if (str_state == STRING_LONG)
-            {
-                // mgos_uart_write(UART_NO, XON_2, 1);
-                mgos_uart_printf(UART_NO, "long\r\n");
-                // mgos_uart_write(UART_NO, XOFF_2, 1);
-            }
-            else if (str_state == STRING_SHORT)
-            {
-                // mgos_uart_write(UART_NO, XON_2, 1);
-                mgos_uart_printf(UART_NO, "short\r\n");
-                // mgos_uart_write(UART_NO, XOFF_2, 1);
-            }
-        }
-        else if (mg_str_starts_with(line, COMMAND_GHR))
+    /* Phase 2: Scan every byte that has not been scanned before, handling each
+       complete line as its CRLF is found, up to the budget */
+    uint8_t lines_handled = 0;
+    while (rx.scanned < rx.len && lines_handled < UART_DISPATCH_LINE_BUDGET)
+    {
+        if (ulwi_link_mode() != rx.mode)
         {
-            /* Get HTTP request */
-            const enum str_len_state str_state = ulwi_validate_strlen(line.len, 9, 9);
-            if (str_state == STRING_OK)
-            {
-                char parameter_c_str[6] = {0};
-                ulwi_cpy_params_only(parameter_c_str, line.p, line.len);
-
-                int handle = -1;
-                enum http_data command_type;
-                enum boolean purge;
-
-                char *token = strtok(parameter_c_str, ULWI_DELIMITER);
-                int param_counter = 0;
-                const int max_param_count = 3;
-                while (token != NULL && param_counter < max_param_count)
-                {
-                    switch (param_counter)
-                    {
-                    case 0:
-                        /* Handle */
-                        handle = validate_handle_string(token);
-                        LOG(LL_INFO, ("GHR handle parsed: %d", handle));
-                        break;
-                    case 1:
-                        /* S/H/C (enum http_data) */
-                        LOG(LL_INFO, ("GHR type parsed: %c", token[0]));
-                        switch (token[0])
-                        {
-                        case 'S':
-                            command_type = STATE;
-                            break;
-                        case 'H':
-                            command_type = HEADER;
-                            break;
-                        case 'C':
-                            command_type = CONTENT;
-                            break;
-                        default:
-                            break;
-                        }
-                        break;
-                    case 2:
-                        /* Boolean for whether to purge the request */
-                        LOG(LL_INFO, ("GHR bool parsed: %c", token[0]));
-                        switch (token[0])
-                        {
-                        case 'T':
-                            purge = ULWI_TRUE;
-                            break;
-                        case 'F':
-                            purge = ULWI_FALSE;
-                            break;
-                        default:
-                            break;
-                        }
-                        break;
-                    }
-                    token = strtok(NULL, ULWI_DELIMITER);
-                    param_counter++;
-                }
-                LOG(LL_INFO, ("GHR param count: %d", param_counter));
-                if (param_counter == max_param_count)
-                {
-                    /* Correct number of arguments, validate the handle again but this time through checking if state is available to read from */
-                    if (response_handle_readable(response_array, handle) == true)
-                    {
-                        struct http_response *http_response = &response_array[handle];
-
-                        switch (command_type)
-                        {
-                        case STATE:
-                            /* Get http_response */
-                            mgos_uart_write(UART_NO, XON_1, 1);
-                            mgos_uart_printf(UART_NO, "%i", http_response->status);
-                            mgos_uart_write(UART_NO, XOFF_1, 1);
-                            break;
-                        case HEADER:
-                            /* Get headers of the HTTP response */
-                            mgos_uart_write(UART_NO, XON_1, 1);
-                            mgos_uart_printf(UART_NO, "%s", http_response->headers);
-                            mgos_uart_write(UART_NO, XOFF_1, 1);
-                            break;
-                        case CONTENT:
-                            /* Get content of the HTTP response */
-                            /* TODO: Ensure proper null termination here */
-                            mgos_uart_write(UART_NO, XON_1, 1);
-                            mgos_uart_printf(UART_NO, "%s", http_response->content.p);
-                            mgos_uart_write(UART_NO, XOFF_1, 1);
-                            break;
-                        default:
-                            break;
-                        }
-
-                        /* See whether or not to purge the request */
-                        if (purge == ULWI_TRUE)
-                        {
-                            /* Purge said request */
-                            ulwi_empty_response(http_response);
-                            ulwi_empty_request(&http_array[handle]);
-                        }
-                    }
-                    else
-                    {
-                        mgos_uart_write(UART_NO, XON_1, 1);
-                        mgos_uart_printf(UART_NO, "U");
-                        mgos_uart_write(UART_NO, XOFF_1, 1);
-                    }
-                }
-                else
-                {
-                    mgos_uart_write(UART_NO, XON_1, 1);
-                    mgos_uart_printf(UART_NO, "short");
-                    mgos_uart_write(UART_NO, XOFF_1, 1);
-                }
-            }
-            else if (str_state == STRING_LONG)
-            {
-                mgos_uart_write(UART_NO, XON_1, 1);
-                mgos_uart_printf(UART_NO, "long");
-                mgos_uart_write(UART_NO, XOFF_1, 1);
-            }
-            else if (str_state == STRING_SHORT)
-            {
-                mgos_uart_write(UART_NO, XON_1, 1);
-                mgos_uart_printf(UART_NO, "short");
-                mgos_uart_write(UART_NO, XOFF_1, 1);
-            }
+            /* A CR or a frame hunt left over from the other mode must not
+               swallow the start of the first command in the new one */
+            rx.mode = ulwi_link_mode();
+            rx.last_cr = false;
+            rx.discarding = false;
         }
-        else if (mg_str_starts_with(line, COMMAND_DHR))
+        if (ulwi_link_mode() == LINK_BINARY)
         {
-            /* Delete HTTP Request */
-            const enum str_len_state str_state = ulwi_validate_strlen(line.len, 5, 5);
-            if (str_state == STRING_OK)
+            /* Frames carry their own length, so they are not scanned byte by
+               byte, and credit grants can only be told apart between them */
+            if (ulwi_txq_flow() == FLOW_CREDIT && !rx.discarding &&
+                (uint8_t)rx.buf[rx.line_start] == CREDIT_GRANT)
             {
-                char parameter_c_str[2] = {0};
-                ulwi_cpy_params_only(parameter_c_str, line.p, line.len);
-
-                const int handle = validate_handle_string(parameter_c_str);
-                if (handle >= 0)
-                {
-                    struct http_request *request = &http_array[handle];
-                    struct http_response *response = &response_array[handle];
-
-                    /* Check if handle number is pointing to an populated handle */
-                    if (request->method || response->status != 0)
-                    {
-                        ulwi_empty_request(request);
-                        ulwi_empty_response(response);
-                        mgos_uart_printf(UART_NO, "S\r\n");
-                    }
-                    else
-                    {
-                        mgos_uart_printf(UART_NO, "U\r\n");
-                    }
-                }
-                else
-                {
-                    /* Invalid handle */
-                    mgos_uart_printf(UART_NO, "U\r\n");
-                }   
+                ulwi_txq_grant();
+                rx.line_start++;
+                rx.scanned = rx.line_start;
+                continue;
             }
-            else if (str_state == STRING_LONG)
+            const size_t line_start = rx.line_start;
+            if (!receive_binary_frame())
             {
-                mgos_uart_printf(UART_NO, "long\r\n");
+                break;
             }
-            else if (str_state == STRING_SHORT)
+            if (rx.line_start - line_start > 1)
             {
-                mgos_uart_printf(UART_NO, "short\r\n");
+                lines_handled++;
             }
+            continue;
         }
-        else if (mg_str_starts_with(line, COMMAND_MCG))
-        {
-            /* MQTT Configure */
-            // 5 arguments max, 3 arguments standard
-
-            const enum str_len_state str_state = ulwi_validate_strlen(line.len, 5, 5 + 320);
-            if (str_state == STRING_OK)
-            {
-                char parameter_c_str[320] = {0};
-                ulwi_cpy_params_only(parameter_c_str, line.p, line.len);
-
-                const int max_params = 5;
-                const int max_param_len = 65;
-                char result[max_params][max_param_len];
 
-                const int param_len = split_parameter_string(parameter_c_str, max_params, max_param_len, result);
-                
-                struct mgos_config_mqtt mqtt_conf = *mgos_sys_config_get_mqtt();
+        const size_t i = rx.scanned++;
+        const char c = rx.buf[i];
 
-                if (param_len == 1)
-                {
-                    /* Enable or disable only */
-                    bool enable = result[0][0] == 'T'; //TODO: does this need additional sanitisation?
-                    if (!enable)
-                    {
-                        /* Allow disable under any circumstances */
-                        mqtt_conf.enable = enable;
-                        ulwi_mqtt_unsub_all();
-                        mgos_mqtt_set_config(&mqtt_conf);
-                        mgos_uart_printf(UART_NO, "S\r\n");
-                    }
-                    else if (mqtt_conf.server != NULL)
-                    {
-                        /* Enable is true in this if statement, only allow enable if server field is not empty */
-                        mqtt_conf.enable = enable;
-                        mgos_mqtt_set_config(&mqtt_conf);
-                        mgos_uart_printf(UART_NO, "S\r\n");
-                    }
-                    else
-                    {
-                        /* Cannot enable if server field is empty */
-                        mgos_uart_printf(UART_NO, "U\r\n");
-                    }
-                }
-                else if (param_len == 3)
-                {
-                    //TODO: add input sanitisation in here
-                    const bool enable_tls = result[2][0] == 'T' ? true : false;
-                    mqtt_conf.enable = result[0][0] == 'T' ? true : false;
-                    mqtt_conf.server = result[1];
-                    mqtt_conf.ssl_ca_cert = enable_tls ? "rootca.pem" : NULL;
-                    mgos_mqtt_set_config(&mqtt_conf);
-                    mgos_uart_printf(UART_NO, "S\r\n");
-                }
-                else if (param_len == 5)
-                {
-                    const bool enable_tls = result[2][0] == 'T' ? true : false;
-                    mqtt_conf.enable = result[0][0] == 'T' ? true : false;
-                    mqtt_conf.server = result[1];
-                    mqtt_conf.user = result[3];
-                    mqtt_conf.pass = result[4];
-                    mqtt_conf.ssl_ca_cert = enable_tls ? "rootca.pem" : NULL;
-                    
-                    if (mgos_mqtt_set_config(&mqtt_conf))
-                    {
-                        if (mgos_mqtt_global_connect())
-                        {
-                            mgos_uart_printf(UART_NO, "S\r\n");
-                        }
-                        else
-                        {
-                            mgos_uart_printf(UART_NO, "U\r\n");
-                        }
-                    }
-                    else
-                    {
-                        mgos_uart_printf(UART_NO, "U\r\n");
-                    }
-                }
-                else
-                {
-                    mgos_uart_printf(UART_NO, "invalid\r\n");
-                }
-            }
-            else if (str_state == STRING_LONG)
-            {
-                mgos_uart_printf(UART_NO, "long\r\n");
-            }
-            else if (str_state == STRING_SHORT)
-            {
-                mgos_uart_printf(UART_NO, "short\r\n");
-            }
-        }
-        else if (mg_str_starts_with(line, COMMAND_MIC) && line.len == 3)
+        if (c == '\n' && rx.last_cr)
         {
-            /* MQTT Is Connected? */
-            if (mgos_mqtt_global_is_connected())
+            /* Full modern Windows style CRLF (\r\n) found */
+            rx.last_cr = false;
+            if (rx.discarding)
             {
-                //TODO WARNING: this function returns true even setting MQTT enable to false. will need to investigate further
-                mgos_uart_printf(UART_NO, "T\r\n");
+                /* End of an overflowed line, resynchronise on the next one */
+                rx.discarding = false;
             }
             else
             {
-                mgos_uart_printf(UART_NO, "F\r\n");
+                /* Null terminate the line in place, replacing CR with NULL,
+                   so that it is a C string without the line ending */
+                rx.buf[i - 1] = '\0';
+                const struct mg_str line = MG_MK_STR_N(rx.buf + rx.line_start, i - 1 - rx.line_start);
+                dispatch_line(line);
+                lines_handled++;
             }
+            rx.line_start = rx.scanned;
+            continue;
         }
-        else if (mg_str_starts_with(line, COMMAND_MSB))
+        rx.last_cr = (c == '\r');
+
+        if (rx.discarding)
         {
-            /* MQTT Subscribe */
-            // 1 argument
-            const enum str_len_state str_state = ulwi_validate_strlen(line.len, 5, 5 + 127);
-            if (str_state == STRING_OK)
-            {
-                char parameter_c_str[128] = {0};
-                ulwi_cpy_params_only(parameter_c_str, line.p, line.len);
-                if (!ulwi_mqtt_sub_exists(parameter_c_str))
-                {
-                    ulwi_mqtt_sub(parameter_c_str, mqtt_sub_handler, NULL);
-                    mgos_uart_printf(UART_NO, "S\r\n");
-                }
-                else mgos_uart_printf(UART_NO, "U\r\n"); /* Subscription already exists */
-            }
-            else if (str_state == STRING_LONG)
-            {
-                mgos_uart_printf(UART_NO, "long\r\n");
-            }
-            else if (str_state == STRING_SHORT)
-            {
-                mgos_uart_printf(UART_NO, "short\r\n");
-            }
+            /* Drop the overflowed line byte by byte until its CRLF arrives */
+            rx.line_start = rx.scanned;
         }
-        else if (mg_str_starts_with(line, COMMAND_MUS))
+        else if (rx.scanned - rx.line_start > UART_RX_LINE_MAX + 1)
         {
-            /* MQTT Unsubscribe */
-            // 1 argument
-            const enum str_len_state str_state = ulwi_validate_strlen(line.len, 5, 5 + 127);
-            if (str_state == STRING_OK)
-            {
-                char parameter_c_str[128] = {0};
-                ulwi_cpy_params_only(parameter_c_str, line.p, line.len);
-                if (ulwi_mqtt_sub_exists(parameter_c_str))
-                {
-                    ulwi_mqtt_unsub(parameter_c_str);
-                    mgos_uart_printf(UART_NO, "S\r\n");
-                }
-                else mgos_uart_printf(UART_NO, "U\r\n"); /* Subscription does not exist */
-            }
-            else if (str_state == STRING_LONG)
-            {
-                mgos_uart_printf(UART_NO, "long\r\n");
-            }
-            else if (str_state == STRING_SHORT)
-            {
-                mgos_uart_printf(UART_NO, "short\r\n");
-            }
+            /* Line cannot fit even with its CRLF, reply once and discard it */
+            ulwi_reply_error(OPCODE_INVALID, REPLY_LONG, FRAME_CRLF);
+            rx.discarding = true;
+            rx.line_start = rx.scanned;
         }
-        else if (mg_str_starts_with(line, COMMAND_MND))
+    }
+
+    /* Phase 3: Release handled lines by moving the partial line to the front,
+       which is at most UART_RX_LINE_MAX bytes */
+    if (rx.line_start > 0)
+    {
+        memmove(rx.buf, rx.buf + rx.line_start, rx.len - rx.line_start);
+        rx.len -= rx.line_start;
+        rx.scanned -= rx.line_start;
+        rx.line_start = 0;
+    }
+
+    /* Phase 4: Give the event loop a turn before draining whatever is left */
+    if (rx.scanned < rx.len || mgos_uart_read_avail(uart_no) > 0)
+    {
+        if (lines_handled == UART_DISPATCH_LINE_BUDGET)
         {
-            /* MQTT check subscription for New Data */
-            const enum str_len_state str_state = ulwi_validate_strlen(line.len, 5, 5 + 127);
-            if (str_state == STRING_OK)
-            {
-                char parameter_c_str[128] = {0};
-                ulwi_cpy_params_only(parameter_c_str, line.p, line.len);
-                if (ulwi_mqtt_sub_exists(parameter_c_str))
-                {
-                    //ulwi_mqtt_new_data_arrived(parameter_c_str) ? mgos_uart_printf(UART_NO, "\x11\x54\x13") : mgos_uart_printf(UART_NO, "\x11\x46\x13");
-                    ulwi_mqtt_new_data_arrived(parameter_c_str) ? mgos_uart_printf(UART_NO, "T\r\n") : mgos_uart_printf(UART_NO, "F\r\n");
-                }
-                else mgos_uart_printf(UART_NO, "U\r\n"); /* Subscription does not exist */
-            }
-            else if (str_state == STRING_LONG)
-            {
-                mgos_uart_printf(UART_NO, "long\r\n");
-            }
-            else if (str_state == STRING_SHORT)
-            {
-                mgos_uart_printf(UART_NO, "short\r\n");
-            }
+            dispatch_stats.budget_exhausted++;
         }
-        else if (mg_str_starts_with(line, COMMAND_MGS))
+        mgos_uart_schedule_dispatcher(uart_no, false);
+    }
+
+    if (lines_handled > 0)
+    {
+        dispatch_stats.wakeups++;
+        dispatch_stats.lines += lines_handled;
+        dispatch_stats.last_lines = lines_handled;
+        if (lines_handled > dispatch_stats.max_lines)
         {
-            /* MQTT Get Subscribed message */
-            const enum str_len_state str_state = ulwi_validate_strlen(line.len, 5, 5 + 127);
-            if (str_state == STRING_OK)
-            {
-                char parameter_c_str[128] = {0};
-                ulwi_cpy_params_only(parameter_c_str, line.p, line.len);
-                struct mg_str *message = ulwi_mqtt_get_sub_message(parameter_c_str);
-                if (message != NULL)
-                {
-                    struct mg_str buffer = mg_strdup_nul(*message);
-                    mgos_uart_write(UART_NO, XON_1, 1);
-                    mgos_uart_write(UART_NO, buffer.p, buffer.len);
-                    mgos_uart_write(UART_NO, XOFF_1, 1);
-                    mg_strfree(&buffer);
-                }
-                else
-                {
-                    mgos_uart_write(UART_NO, XON_1, 1);
-                    mgos_uart_printf(UART_NO, "U"); /* Subscription does not exist */
-                    mgos_uart_write(UART_NO, XOFF_1, 1);
-                }
-            }
-            else if (str_state == STRING_LONG)
-            {
-                mgos_uart_write(UART_NO, XON_1, 1);
-                mgos_uart_printf(UART_NO, "long");
-                mgos_uart_write(UART_NO, XOFF_1, 1);
-            }
-            else if (str_state == STRING_SHORT)
-            {
-                mgos_uart_write(UART_NO, XON_1, 1);
-                mgos_uart_printf(UART_NO, "short");
-                mgos_uart_write(UART_NO, XOFF_1, 1);
-            }
+            dispatch_stats.max_lines = lines_handled;
         }
-        else if (mg_str_starts_with(line, COMMAND_MPB))
-        {
-            /* MQTT Publish */
-            // 4 arguments
-            const enum str_len_state str_state = ulwi_validate_strlen(line.len, 5, 5 + 255);
-            if (str_state == STRING_OK)
-            {
-                char parameter_c_str[256] = {0};
-                ulwi_cpy_params_only(parameter_c_str, line.p, line.len);
+    }
+    (void)arg;
+}
 
-                const int max_params = 4;
-                const int max_param_len = 64;
-                char result[max_params][max_param_len];
+#if ULWI_BENCHMARK
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: dispatch_benchmark                                          *
+ *                                                                            *
+ * PURPOSE: Logs the cost in cycles of decoding every opcode, comparing the   *
+ *          original chain of mg_str_starts_with calls (in its original       *
+ *          order) against the packed integer switch of ulwi_decode_opcode.   *
+ *                                                                            *
+ * ARGUMENTS: N/A                                                             *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+static void dispatch_benchmark(void)
+{
+    /* Order in which the original if/else chain compared the commands */
+    static const struct mg_str legacy_chain[] = {
+        MG_MK_STR("nop"), MG_MK_STR("ver"), MG_MK_STR("rst"), MG_MK_STR("lap"), MG_MK_STR("cap"),
+        MG_MK_STR("sap"), MG_MK_STR("dap"), MG_MK_STR("gip"), MG_MK_STR("ihr"), MG_MK_STR("phr"),
+        MG_MK_STR("hhr"), MG_MK_STR("thr"), MG_MK_STR("shr"), MG_MK_STR("ghr"), MG_MK_STR("dhr"),
+        MG_MK_STR("mcg"), MG_MK_STR("mic"), MG_MK_STR("msb"), MG_MK_STR("mus"), MG_MK_STR("mnd"),
+        MG_MK_STR("mgs"), MG_MK_STR("mpb"), MG_MK_STR("ota")
+    };
+    const size_t legacy_len = sizeof(legacy_chain) / sizeof(legacy_chain[0]);
+    const int iterations = 100;
 
-                const int param_len = split_parameter_string(parameter_c_str, max_params, max_param_len, result);
-                if (param_len == 4)
-                {
-                    if (mgos_mqtt_pub(result[0], result[1], strlen(result[1]), 0, false))
-                    {
-                        mgos_uart_printf(UART_NO, "S\r\n");
-                    }
-                    else
-                    {
-                        mgos_uart_printf(UART_NO, "U\r\n");
-                    }
-                }
-                else
-                {
-                    mgos_uart_printf(UART_NO, "invalid\r\n");
-                }
-            }
-            else if (str_state == STRING_LONG)
-            {
-                mgos_uart_printf(UART_NO, "long\r\n");
-            }
-            else if (str_state == STRING_SHORT)
+    for (size_t i = 0; i < legacy_len; i++)
+    {
+        const struct mg_str line = legacy_chain[i];
+        volatile size_t legacy_match = 0;
+        volatile enum ulwi_opcode opcode = OPCODE_INVALID;
+
+        uint32_t start = ulwi_cycle_count();
+        for (int n = 0; n < iterations; n++)
+        {
+            size_t j = 0;
+            while (j < legacy_len && !mg_str_starts_with(line, legacy_chain[j]))
             {
-                mgos_uart_printf(UART_NO, "short\r\n");
+                j++;
             }
+            legacy_match = j;
         }
-        else
+        const uint32_t legacy_cycles = ulwi_cycle_count() - start;
+
+        start = ulwi_cycle_count();
+        for (int n = 0; n < iterations; n++)
         {
-            mgos_uart_printf(UART_NO, "invalid\r\n");
+            opcode = ulwi_decode_opcode(line);
         }
+        const uint32_t table_cycles = ulwi_cycle_count() - start;
+
+        LOG(LL_INFO, ("dispatch %.*s: chain %lu, table %lu (x%d)", (int)line.len, line.p,
+                      (unsigned long)legacy_cycles, (unsigned long)table_cycles, iterations));
+        (void)legacy_match;
+        (void)opcode;
     }
+}
 
-    mbuf_remove(&buffer, line_length + 1); /* Release the buffer */
-    (void)arg;
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: tokenizer_benchmark                                         *
+ *                                                                            *
+ * PURPOSE: Logs the cost in cycles and stack of splitting the parameters of  *
+ *          a cap command, comparing ulwi_cpy_params_only followed by         *
+ *          split_parameter_string against the zero-copy ulwi_split_params.   *
+ *          Both loops restore the line first, as the tokenizer writes null   *
+ *          terminators into it.                                              *
+ *                                                                            *
+ * ARGUMENTS: N/A                                                             *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+static void tokenizer_benchmark(void)
+{
+    static const char sample[] = "cap ssid" "\x1f" "password" "\x1f" "192.168.1.2" "\x1f" "192.168.1.1" "\x1f" "255.255.255.0";
+    char line_buf[sizeof(sample)];
+    const struct mg_str line = MG_MK_STR_N(line_buf, sizeof(sample) - 1);
+    const struct mg_str params = MG_MK_STR_N(line_buf + 4, sizeof(sample) - 5);
+    const int iterations = 100;
+    volatile int param_len = 0;
+
+    uint32_t start = ulwi_cycle_count();
+    for (int n = 0; n < iterations; n++)
+    {
+        memcpy(line_buf, sample, sizeof(sample));
+        char parameter_c_str[256] = {0};
+        char result[5][65];
+        ulwi_cpy_params_only(parameter_c_str, line.p, line.len);
+        param_len = split_parameter_string(parameter_c_str, 5, 65, result);
+    }
+    const uint32_t legacy_cycles = ulwi_cycle_count() - start;
+
+    start = ulwi_cycle_count();
+    for (int n = 0; n < iterations; n++)
+    {
+        memcpy(line_buf, sample, sizeof(sample));
+        struct mg_str result[5];
+        param_len = ulwi_split_params(params, result, 5);
+    }
+    const uint32_t tokenizer_cycles = ulwi_cycle_count() - start;
+
+    LOG(LL_INFO, ("tokenizer: legacy %lu cycles %lu bytes, slices %lu cycles %lu bytes (x%d)",
+                  (unsigned long)legacy_cycles, (unsigned long)(256 + 5 * 65),
+                  (unsigned long)tokenizer_cycles, (unsigned long)(5 * sizeof(struct mg_str)),
+                  iterations));
+    (void)param_len;
 }
+#endif /* ULWI_BENCHMARK */
 
 enum mgos_app_init_result mgos_app_init(void)
 {
@@ -941,6 +1868,10 @@ enum mgos_app_init_result mgos_app_init(void)
     mgos_set_stderr_uart(-1);  /* Disables stderr */
     cs_log_set_level(LL_NONE); /* Disables all logging*/
 #endif
+#if ULWI_BENCHMARK
+    dispatch_benchmark();  /* Log the cost of decoding every command */
+    tokenizer_benchmark(); /* Log the cost of splitting parameters */
+#endif
 
     /* Configure UART port */
     struct mgos_uart_config ucfg;
@@ -948,8 +1879,12 @@ enum mgos_app_init_result mgos_app_init(void)
 #ifndef DEVELOPMENT
     ucfg.baud_rate = 9600; /* Defaults to 115200 in development, 9600 in production */
 #endif
+    if (mgos_sys_config_get_ulwi_baud_rate() > 0)
+    {
+        ucfg.baud_rate = mgos_sys_config_get_ulwi_baud_rate(); /* Saved by sbr */
+    }
     ucfg.num_data_bits = 8;
-    ucfg.rx_buf_size = 1024;
+    ucfg.rx_buf_size = UART_RX_BUF_SIZE; /* Set through cdefs in mos.yml */
     ucfg.tx_buf_size = 1024;
     ucfg.parity = MGOS_UART_PARITY_NONE;
     ucfg.stop_bits = MGOS_UART_STOP_BITS_1;
@@ -963,6 +1898,16 @@ enum mgos_app_init_result mgos_app_init(void)
     mgos_uart_set_dispatcher(UART_NO, uart_dispatcher, NULL /* arg */);
     mgos_uart_set_rx_enabled(UART_NO, true); /* Enable UART receiver */
 
+    /* Size the HTTP handle table from the configuration */
+    if (!ulwi_http_init())
+    {
+        return MGOS_APP_INIT_ERROR;
+    }
+
+    ulwi_pool_init();
+    ulwi_tls_init();
+    ulwi_cond_init();
+
     /* Setup Wi-Fi event handlers */
     mgos_event_add_group_handler(MGOS_EVENT_GRP_NET, wifi_cb, NULL);
 
@@ -1,7 +1,34 @@
 #include "mqtt.h"
+#include "event.h"
+#include "common.h"
+#include "tls.h"
+#include "dns.h"
+#include "reply.h"
+#include "txqueue.h"
 
 struct mqtt_subscription *ulwi_mqtt_subscriptions = NULL;
 
+/* Settings given to mcg. The MQTT library resolves its server on every
+   reconnect, so it is given the cached address of the server instead where
+   possible, and these are kept to give it a fresh address once the cached
+   one expires */
+static struct
+{
+    bool enable;
+    char *server;               /* host:port given to mcg, NULL if none */
+    char *user;
+    char *pass;
+    const char *ssl_ca_cert;    /* NULL if TLS is disabled */
+    char address[24];           /* a.b.c.d:port given to the library instead of server, empty if none */
+} mqtt_settings;
+
+/* Deferred reply of a pipelined mcg that waits for the broker to answer */
+static struct
+{
+    int slot;                   /* Deferred reply slot, -1 if none */
+    mgos_timer_id timer;        /* Gives up after MQTT_CONNECT_TIMEOUT_MS */
+} connect_reply = { -1, MGOS_INVALID_TIMER_ID };
+
 struct mqtt_subscription *ulwi_mqtt_get_sub(const char *topic)
 {
     struct mqtt_subscription *s;
@@ -17,13 +44,185 @@ bool ulwi_mqtt_sub_exists(const char *topic)
     else return false;
 }
 
+/* Replaces a heap copy of a setting with a copy of a new value */
+static void replace_setting(char **setting, const char *value)
+{
+    char *copy = value != NULL ? strdup(value) : NULL;
+    free(*setting);
+    *setting = copy;
+}
+
+/* Nothing to do once a lookup started by apply_settings is answered, the
+   address is in the cache for the next reconnect */
+static void warm_cb(bool ok, uint32_t address, void *arg)
+{
+    (void) ok;
+    (void) address;
+    (void) arg;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: apply_settings                                              *
+ *                                                                            *
+ * PURPOSE: Gives the settings of mcg to the MQTT library, with the server    *
+ *          replaced by its cached address if it has one. TLS connections     *
+ *          keep the host name, which the certificate is checked against. If  *
+ *          the address is not cached the library resolves the host name      *
+ *          itself, and a lookup is started to cache it for the next time.    *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE    I/O DESCRIPTION                                           *
+ * -------- ------- --- -----------                                           *
+ * changed  bool     I  Only give the settings if the address has changed     *
+ *                                                                            *
+ * RETURNS: the result of mgos_mqtt_set_config, true if nothing was given     *
+ *                                                                            *
+ *****************************************************************************/
+static bool apply_settings(bool changed)
+{
+    char address[sizeof(mqtt_settings.address)] = "";
+    if (mqtt_settings.server != NULL && mqtt_settings.ssl_ca_cert == NULL)
+    {
+        const char *port = strrchr(mqtt_settings.server, ':');
+        const size_t len = port != NULL ? (size_t)(port - mqtt_settings.server) : strlen(mqtt_settings.server);
+        char host[DNS_HOST_MAX];
+        uint32_t resolved;
+        if (len > 0 && len < sizeof(host))
+        {
+            memcpy(host, mqtt_settings.server, len);
+            host[len] = '\0';
+            if (ulwi_dns_lookup(host, &resolved))
+            {
+                const uint8_t *octets = (const uint8_t *) &resolved;
+                snprintf(address, sizeof(address), "%u.%u.%u.%u%s", octets[0], octets[1], octets[2], octets[3],
+                         port != NULL ? port : "");
+            }
+            else if (mqtt_settings.enable)
+            {
+                ulwi_dns_resolve(host, warm_cb, NULL);
+            }
+        }
+    }
+    if (changed && strcmp(address, mqtt_settings.address) == 0)
+    {
+        return true;
+    }
+    strcpy(mqtt_settings.address, address);
+
+    struct mgos_config_mqtt conf = *mgos_sys_config_get_mqtt();
+    conf.enable = mqtt_settings.enable;
+    conf.server = address[0] != '\0' ? mqtt_settings.address : mqtt_settings.server;
+    conf.user = mqtt_settings.user;
+    conf.pass = mqtt_settings.pass;
+    conf.ssl_ca_cert = mqtt_settings.ssl_ca_cert;
+    return mgos_mqtt_set_config(&conf);
+}
+
+/* Gives the library a fresh address if the one it has is no longer cached */
+static void refresh_address_cb(void *arg)
+{
+    apply_settings(true);
+    (void) arg;
+}
+
+/* Sends the deferred reply of a pipelined mcg, if the master is waiting for one */
+static void complete_connect(bool connected)
+{
+    if (connect_reply.slot < 0)
+    {
+        return;
+    }
+    mgos_clear_timer(connect_reply.timer);
+    connect_reply.timer = MGOS_INVALID_TIMER_ID;
+    ulwi_reply_complete(connect_reply.slot, FRAME_CRLF, connected ? "S" : "U", 1);
+    connect_reply.slot = -1;
+}
+
+static void connect_timeout_cb(void *arg)
+{
+    connect_reply.timer = MGOS_INVALID_TIMER_ID;
+    complete_connect(false);
+    (void) arg;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_mqtt_defer_connect                                     *
+ *                                                                            *
+ * PURPOSE: Holds the reply of a pipelined mcg that enabled the client until  *
+ *          the broker answers: S once it accepts the connection, U if it     *
+ *          refuses it or has not answered within MQTT_CONNECT_TIMEOUT_MS.    *
+ *          The library keeps reconnecting either way.                        *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT   TYPE    I/O DESCRIPTION                                         *
+ * ---------- ------- --- -----------                                         *
+ * reply_slot int      I  Deferred reply slot of the mcg command              *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+void ulwi_mqtt_defer_connect(int reply_slot)
+{
+    complete_connect(false);
+    connect_reply.slot = reply_slot;
+    connect_reply.timer = mgos_set_timer(MQTT_CONNECT_TIMEOUT_MS, 0, connect_timeout_cb, NULL);
+}
+
+/* Takes the settings of mcg, see apply_settings. A pipelined mcg still
+   waiting for a connection that is now disabled gets U. */
+bool ulwi_mqtt_set_config(const struct mgos_config_mqtt *conf)
+{
+    mqtt_settings.enable = conf->enable;
+    if (!conf->enable)
+    {
+        complete_connect(false);
+    }
+    if (conf->server != mqtt_settings.address)
+    {
+        replace_setting(&mqtt_settings.server, conf->server);
+    }
+    replace_setting(&mqtt_settings.user, conf->user);
+    replace_setting(&mqtt_settings.pass, conf->pass);
+    mqtt_settings.ssl_ca_cert = conf->ssl_ca_cert;
+    return apply_settings(false);
+}
+
 void mqtt_ev_handler(struct mg_connection *c, int ev, void *p, void *user_data) {
     struct mg_mqtt_message *msg = (struct mg_mqtt_message *) p;
 
     // if (ev != 0) LOG(LL_DEBUG, ("Global MQTT handler received: %d", ev));
-    if (ev == MG_EV_MQTT_CONNACK)
+    if (ev == MG_EV_POLL && (c->flags & MG_F_CONNECTING))
+    {
+        /* The connection is made inside the MQTT library, so its cached
+           session is offered on the first poll, before the socket connects */
+        char key[ULWI_SERVER_KEY_MAX];
+        const char *server = mqtt_settings.server;
+        if (server != NULL && snprintf(key, sizeof(key), "mqtts://%s", server) < (int)sizeof(key))
+        {
+            ulwi_tls_offer(c, key);
+        }
+    }
+    else if (ev == MG_EV_CONNECT && *(int *) p == 0)
+    {
+        ulwi_tls_established(c);
+    }
+    else if (ev == MG_EV_CLOSE)
+    {
+        ulwi_tls_forget(c);
+        if (mqtt_settings.address[0] != '\0')
+        {
+            /* Check the address before the library reconnects to it */
+            mgos_set_timer(0, 0, refresh_address_cb, NULL);
+        }
+    }
+    else if (ev == MG_EV_MQTT_CONNACK)
     {
         LOG(LL_INFO, ("CONNACK: %d", msg->connack_ret_code));
+        complete_connect(msg->connack_ret_code == 0);
     }
     else if (ev == MG_EV_MQTT_UNSUBSCRIBE) /*UNSUBACK is also here*/
     {
@@ -34,6 +233,14 @@ void mqtt_ev_handler(struct mg_connection *c, int ev, void *p, void *user_data)
     (void) c;
 }
 
+/* Frees the last message of a subscription, copying out any mgs reply that
+   is still queued from it */
+static void free_message(struct mqtt_subscription *sub)
+{
+    ulwi_txq_detach(sub->message.p, sub->message.len);
+    mg_strfree(&sub->message);
+}
+
 void mqtt_sub_handler(struct mg_connection *nc, const char *topic, int topic_len, const char *msg, int msg_len, void *ud)
 {
     /* Free previous string and reset new counter */
@@ -47,10 +254,11 @@ void mqtt_sub_handler(struct mg_connection *nc, const char *topic, int topic_len
         return;
     }
 
-    mg_strfree(&sub->message);
+    free_message(sub);
     sub->new = true;
     sub->active = true;
     sub->message = mg_strdup_nul(mg_mk_str_n(msg, msg_len));
+    ulwi_event_mqtt(topic_str.p);
     mg_strfree(&topic_str);
     (void) nc;
     (void) ud;
@@ -94,7 +302,7 @@ bool ulwi_mqtt_unsub(char *topic)
         struct mqtt_subscription *s;
         s = ulwi_mqtt_get_sub(topic);
 
-        if (s->message.len > 0) mg_strfree(&s->message);
+        free_message(s);
         HASH_DEL(ulwi_mqtt_subscriptions, s);
         free(s);
 
@@ -114,7 +322,7 @@ void ulwi_mqtt_unsub_all()
     {
         strlcpy(topic_buffer, current_sub->topic, 128);
 
-        if (current_sub->message.len > 0) mg_strfree(&current_sub->message);
+        free_message(current_sub);
         HASH_DEL(ulwi_mqtt_subscriptions, current_sub);
         free(current_sub);
 
@@ -136,3 +344,29 @@ struct mg_str *ulwi_mqtt_get_sub_message(const char *topic)
     sub->new = false;
     return &sub->message;
 }
+
+/* Appends one bit per subscription, in the order they were subscribed, set
+   if the subscription has new data. Returns whether any bit was set */
+bool ulwi_mqtt_append_new_data_bits(struct mbuf *bits)
+{
+    struct mqtt_subscription *current_sub, *tmp;
+    uint8_t byte = 0;
+    uint8_t bit = 0;
+    bool any = false;
+    HASH_ITER(hh, ulwi_mqtt_subscriptions, current_sub, tmp)
+    {
+        if (current_sub->new)
+        {
+            byte |= 1 << bit;
+            any = true;
+        }
+        if (++bit == 8)
+        {
+            mbuf_append(bits, &byte, 1);
+            byte = 0;
+            bit = 0;
+        }
+    }
+    if (bit > 0) mbuf_append(bits, &byte, 1);
+    return any;
+}
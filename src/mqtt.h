@@ -10,6 +10,9 @@
 // bool mqtt_subscribed_active[3] = { false };     /* Boolean flag for if the current MQTT subscription is active */
 // bool mqtt_subscribed_new[3] = { false };        /* Boolean flag for indicating whether the MQTT subscription has new data inbound */
 
+/* Time a pipelined mcg waits for the broker to accept the connection before replying U */
+#define MQTT_CONNECT_TIMEOUT_MS 10000
+
 struct mqtt_subscription
 {
     char topic[128];        /* Topic of the MQTT subscription which also acts as the key */
@@ -24,10 +27,13 @@ bool ulwi_mqtt_sub_exists(const char *topic);
 void mqtt_ev_handler(struct mg_connection *c, int ev, void *p, void *user_data);
 void mqtt_sub_handler(struct mg_connection *nc, const char *topic, int topic_len, const char *msg, int msg_len, void *ud);
 
+bool ulwi_mqtt_set_config(const struct mgos_config_mqtt *conf);
+void ulwi_mqtt_defer_connect(int reply_slot);
 void ulwi_mqtt_sub(const char *topic, sub_handler_t handler, void *user_data);
 bool ulwi_mqtt_unsub(char *topic);
 void ulwi_mqtt_unsub_all();
 bool ulwi_mqtt_new_data_arrived(const char *topic);
 struct mg_str *ulwi_mqtt_get_sub_message(const char *topic);
+bool ulwi_mqtt_append_new_data_bits(struct mbuf *bits);
 
 #endif
\ No newline at end of file
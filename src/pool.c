@@ -0,0 +1,248 @@
+#include "pool.h"
+#include "common.h"
+
+/* A connection kept open for reuse */
+struct pool_entry
+{
+    char key[ULWI_SERVER_KEY_MAX];  /* scheme://host:port of the server */
+    struct mg_connection *nc;       /* NULL if the entry is free */
+    bool busy;                      /* Whether a request is in progress on the connection */
+    int64_t idle_since;             /* When the last request on the connection finished */
+};
+
+static struct pool_entry pool[HTTP_POOL_MAX];
+static struct ulwi_pool_stats pool_stats;
+
+/* Closes an idle connection, its entry is freed when it reports MG_EV_CLOSE */
+static void pool_evict(struct pool_entry *entry)
+{
+    entry->nc->flags |= MG_F_CLOSE_IMMEDIATELY;
+    entry->busy = true; /* Never hand out a closing connection */
+    pool_stats.evicted++;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: pool_sweep_cb                                               *
+ *                                                                            *
+ * PURPOSE: Closes connections that have been idle for HTTP_POOL_IDLE_MS, and *
+ *          every idle connection if the heap is running low                  *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE    I/O DESCRIPTION                                           *
+ * -------- ------- --- -----------                                           *
+ * arg      void *   I  Unused                                                *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+static void pool_sweep_cb(void *arg)
+{
+    const int64_t now = mgos_uptime_micros();
+    const bool low_heap = mgos_get_free_heap_size() < HTTP_POOL_HEAP_MIN;
+    for (size_t i = 0; i < HTTP_POOL_MAX; i++)
+    {
+        struct pool_entry *entry = &pool[i];
+        if (entry->nc != NULL && !entry->busy &&
+            (low_heap || now - entry->idle_since > (int64_t)HTTP_POOL_IDLE_MS * 1000))
+        {
+            pool_evict(entry);
+        }
+    }
+    (void)arg;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_pool_init                                              *
+ *                                                                            *
+ * PURPOSE: Starts closing idle connections periodically                      *
+ *                                                                            *
+ * ARGUMENTS: none                                                            *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+void ulwi_pool_init(void)
+{
+    mgos_set_timer(1000, MGOS_TIMER_REPEAT, pool_sweep_cb, NULL);
+}
+
+/* Returns the entry of an idle connection to the server of a URL, or NULL */
+static struct pool_entry *find_idle(const char *url)
+{
+    char key[ULWI_SERVER_KEY_MAX];
+    if (!ulwi_server_key(url, key))
+    {
+        return NULL;
+    }
+    for (size_t i = 0; i < HTTP_POOL_MAX; i++)
+    {
+        struct pool_entry *entry = &pool[i];
+        if (entry->nc != NULL && !entry->busy && strcmp(entry->key, key) == 0)
+        {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_pool_acquire                                           *
+ *                                                                            *
+ * PURPOSE: Finds an idle connection to the server of a URL and marks it busy *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE    I/O DESCRIPTION                                           *
+ * -------- ------- --- -----------                                           *
+ * url      char *   I  The URL of the request                                *
+ *                                                                            *
+ * RETURNS: the connection, or NULL if a new connection has to be opened      *
+ *                                                                            *
+ *****************************************************************************/
+struct mg_connection *ulwi_pool_acquire(const char *url)
+{
+    struct pool_entry *entry = find_idle(url);
+    if (entry == NULL)
+    {
+        pool_stats.misses++;
+        return NULL;
+    }
+    entry->busy = true;
+    pool_stats.hits++;
+    return entry->nc;
+}
+
+/* Returns whether a request to a URL would be sent on an idle connection */
+bool ulwi_pool_has_idle(const char *url)
+{
+    return find_idle(url) != NULL;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_pool_add                                               *
+ *                                                                            *
+ * PURPOSE: Offers a new connection to the pool, which keeps it for reuse if  *
+ *          it has a free entry and enough heap. An idle connection to        *
+ *          another server is closed to make room if necessary.               *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE           I/O DESCRIPTION                                    *
+ * -------- -------------- --- -----------                                    *
+ * url      char *          I  The URL of the request                         *
+ * nc       mg_connection * I  The connection that was opened for it          *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+void ulwi_pool_add(const char *url, struct mg_connection *nc)
+{
+    char key[ULWI_SERVER_KEY_MAX];
+    if (nc == NULL || !ulwi_server_key(url, key) || mgos_get_free_heap_size() < HTTP_POOL_HEAP_MIN)
+    {
+        return;
+    }
+
+    struct pool_entry *free_entry = NULL;
+    struct pool_entry *oldest_idle = NULL;
+    for (size_t i = 0; i < HTTP_POOL_MAX; i++)
+    {
+        struct pool_entry *entry = &pool[i];
+        if (entry->nc == NULL)
+        {
+            free_entry = entry;
+            break;
+        }
+        if (!entry->busy && (oldest_idle == NULL || entry->idle_since < oldest_idle->idle_since))
+        {
+            oldest_idle = entry;
+        }
+    }
+    if (free_entry == NULL)
+    {
+        /* The new connection is not pooled this time, but the next one can be */
+        if (oldest_idle != NULL) pool_evict(oldest_idle);
+        return;
+    }
+    strcpy(free_entry->key, key);
+    free_entry->nc = nc;
+    free_entry->busy = true;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_pool_release                                           *
+ *                                                                            *
+ * PURPOSE: Returns a connection to the pool once its response is complete    *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE           I/O DESCRIPTION                                    *
+ * -------- -------------- --- -----------                                    *
+ * nc       mg_connection * I  The connection                                 *
+ *                                                                            *
+ * RETURNS: true if the connection is kept open, false if it is not pooled    *
+ *          and should be closed                                              *
+ *                                                                            *
+ *****************************************************************************/
+bool ulwi_pool_release(struct mg_connection *nc)
+{
+    for (size_t i = 0; i < HTTP_POOL_MAX; i++)
+    {
+        if (pool[i].nc == nc)
+        {
+            pool[i].busy = false;
+            pool[i].idle_since = mgos_uptime_micros();
+            return true;
+        }
+    }
+    return false;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_pool_remove                                            *
+ *                                                                            *
+ * PURPOSE: Forgets a connection that has closed                              *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE           I/O DESCRIPTION                                    *
+ * -------- -------------- --- -----------                                    *
+ * nc       mg_connection * I  The connection                                 *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+void ulwi_pool_remove(struct mg_connection *nc)
+{
+    for (size_t i = 0; i < HTTP_POOL_MAX; i++)
+    {
+        if (pool[i].nc == nc)
+        {
+            pool[i].nc = NULL;
+        }
+    }
+}
+
+/* Returns the number of connections in the pool, busy or idle */
+size_t ulwi_pool_open(void)
+{
+    size_t open = 0;
+    for (size_t i = 0; i < HTTP_POOL_MAX; i++)
+    {
+        if (pool[i].nc != NULL) open++;
+    }
+    return open;
+}
+
+/* Returns the reuse counters of the pool */
+const struct ulwi_pool_stats *ulwi_pool_get_stats(void)
+{
+    return &pool_stats;
+}
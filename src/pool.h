@@ -0,0 +1,49 @@
+/******************************************************************************
+ *                                                                            *
+ * NAME: pool.h                                                               *
+ *                                                                            *
+ * PURPOSE: Provides a pool of keep-alive HTTP connections per server         *
+ *                                                                            *
+ * GLOBAL VARIABLES:                                                          *
+ *                                                                            *
+ * Variable Type Description                                                  *
+ * -------- ---- -----------                                                  *
+ *                                                                            *
+ *                                                                            *
+ *****************************************************************************/
+
+#ifndef POOL_H
+#define POOL_H
+
+#include "mgos.h"
+
+/* Most connections kept open, each costs a socket and, for HTTPS, the TLS state */
+#ifndef HTTP_POOL_MAX
+#define HTTP_POOL_MAX 2
+#endif
+/* Idle connections are closed after this long */
+#ifndef HTTP_POOL_IDLE_MS
+#define HTTP_POOL_IDLE_MS 15000
+#endif
+/* Connections are only kept open while at least this much heap is free */
+#ifndef HTTP_POOL_HEAP_MIN
+#define HTTP_POOL_HEAP_MIN 12288
+#endif
+
+struct ulwi_pool_stats
+{
+    uint32_t hits;      /* Requests sent on a connection that was already open */
+    uint32_t misses;    /* Requests that had to open a new connection */
+    uint32_t evicted;   /* Idle connections closed for time or heap */
+};
+
+void ulwi_pool_init(void);
+struct mg_connection *ulwi_pool_acquire(const char *url);
+bool ulwi_pool_has_idle(const char *url);
+void ulwi_pool_add(const char *url, struct mg_connection *nc);
+bool ulwi_pool_release(struct mg_connection *nc);
+void ulwi_pool_remove(struct mg_connection *nc);
+size_t ulwi_pool_open(void);
+const struct ulwi_pool_stats *ulwi_pool_get_stats(void);
+
+#endif
@@ -0,0 +1,522 @@
+#include "reply.h"
+#include "common.h"
+#include "constants.h"
+#include "txqueue.h"
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_reply_puts                                             *
+ *                                                                            *
+ * PURPOSE: Appends a C string to a reply that is being built by a command    *
+ *          handler. The string is appended without any framing.             *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE    I/O DESCRIPTION                                           *
+ * -------- ------- --- -----------                                           *
+ * reply    mbuf *   O  The reply buffer to append to                         *
+ * str      char *   I  The null terminated string to append                  *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+void ulwi_reply_puts(struct mbuf *reply, const char *str)
+{
+    mbuf_append(reply, str, strlen(str));
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_reply_printf                                           *
+ *                                                                            *
+ * PURPOSE: printf style formatting into a reply that is being built by a     *
+ *          command handler. Small replies are formatted on the stack and     *
+ *          only larger ones fall back to the heap.                           *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE    I/O DESCRIPTION                                           *
+ * -------- ------- --- -----------                                           *
+ * reply    mbuf *   O  The reply buffer to append to                         *
+ * fmt      char *   I  printf style format string                            *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+void ulwi_reply_printf(struct mbuf *reply, const char *fmt, ...)
+{
+    char mem[32];
+    char *buf = mem;
+    va_list ap;
+    va_start(ap, fmt);
+    const int len = mg_avprintf(&buf, sizeof(mem), fmt, ap);
+    va_end(ap);
+    if (len > 0)
+    {
+        mbuf_append(reply, buf, len);
+    }
+    if (buf != mem)
+    {
+        free(buf);
+    }
+}
+
+/* Current mode of the UART link and the mode to switch to after the next reply */
+static enum link_mode link_mode = LINK_TEXT;
+static enum link_mode link_pending_mode = LINK_TEXT;
+
+/* Whether commands and replies carry a sequence tag, and the tag of the
+   command that is currently being dispatched */
+static bool link_tagged = false;
+static bool link_pending_tagged = false;
+static char current_tag = '\0';
+
+/* Replies that a handler will only send once an asynchronous operation completes */
+struct deferred_reply
+{
+    enum ulwi_opcode opcode;    /* Command that is waiting for its reply */
+    bool tagged;                /* Whether the command was sent with a sequence tag */
+    char tag;                   /* Sequence tag of the command */
+    bool used;                  /* Whether this slot is outstanding */
+};
+static struct deferred_reply deferred_replies[PIPELINE_WINDOW];
+
+/* Whether the command being dispatched tried to defer its reply, which is
+   then only sent by ulwi_reply_complete and never when the handler returns */
+static bool current_deferred = false;
+
+/* Buffer that the reply of the current command is queued from by reference,
+   see ulwi_reply_borrow */
+static const char *borrowed_data;
+static size_t borrowed_len;
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: queue_payload                                               *
+ *                                                                            *
+ * PURPOSE: Queues the payload of a reply for transmission, handing over the  *
+ *          buffer it is in when the reply owns one so that it is not copied  *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE    I/O DESCRIPTION                                           *
+ * -------- ------- --- -----------                                           *
+ * data     char *   I  The payload                                           *
+ * len      size_t   I  Length of the payload                                 *
+ * owned    char *   I  Heap buffer holding the payload, or NULL              *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+static void queue_payload(const char *data, size_t len, char *owned)
+{
+    if (owned != NULL)
+    {
+        ulwi_txq_adopt(owned, len);
+    }
+    else if (data == borrowed_data && data != NULL)
+    {
+        ulwi_txq_static(data, len);
+    }
+    else
+    {
+        ulwi_txq_copy(data, len);
+    }
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: send_binary_frame                                           *
+ *                                                                            *
+ * PURPOSE: Writes a binary frame: 1 byte opcode, varint payload length,      *
+ *          payload and a big endian CRC-16 over everything before it. A      *
+ *          sequence tag, if any, is the first byte of the payload.           *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE    I/O DESCRIPTION                                           *
+ * -------- ------- --- -----------                                           *
+ * opcode   uint8_t  I  The opcode of the frame                               *
+ * tag      char *   I  The sequence tag to prefix the payload with, or NULL  *
+ * data     char *   I  The payload of the frame                              *
+ * len      size_t   I  Length of the payload                                 *
+ * owned    char *   I  Heap buffer holding the payload to hand over to the   *
+ *                      transmit queue, or NULL to queue a copy of it         *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+static void send_binary_frame(uint8_t opcode, const char *tag, const char *data, size_t len, char *owned)
+{
+    const size_t tag_len = tag != NULL ? 1 : 0;
+    uint8_t header[1 + ULWI_VARINT_MAX + 1];
+    header[0] = opcode;
+    size_t header_len = 1 + ulwi_varint_encode(tag_len + len, header + 1);
+    if (tag != NULL)
+    {
+        header[header_len++] = (uint8_t)*tag;
+    }
+
+    uint16_t crc = ulwi_crc16(ULWI_CRC16_INIT, header, header_len);
+    crc = ulwi_crc16(crc, (const uint8_t *)data, len);
+    const uint8_t trailer[2] = { crc >> 8, crc & 0xFF };
+
+    ulwi_txq_copy(header, header_len);
+    queue_payload(data, len, owned);
+    ulwi_txq_copy(trailer, sizeof(trailer));
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: send_reply                                                  *
+ *                                                                            *
+ * PURPOSE: Writes a reply in the current link mode, with an optional         *
+ *          sequence tag in front of the payload (inside the framing)         *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE          I/O DESCRIPTION                                     *
+ * -------- ------------- --- -----------                                     *
+ * opcode   uint8_t        I  The binary opcode of the reply                  *
+ * framing  reply_framing  I  How the reply should be delimited in text mode  *
+ * tag      char *         I  The sequence tag of the command, or NULL        *
+ * data     char *         I  The reply payload, does not need termination    *
+ * len      size_t         I  Length of the reply payload                     *
+ * owned    char *         I  Heap buffer holding the payload to hand over to *
+ *                            the transmit queue, or NULL to queue a copy     *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+static void send_reply(uint8_t opcode, enum reply_framing framing, const char *tag, const char *data, size_t len, char *owned)
+{
+    if (link_mode == LINK_BINARY)
+    {
+        send_binary_frame(opcode, tag, data, len, owned);
+    }
+    else if (framing == FRAME_CRLF)
+    {
+        if (tag != NULL) ulwi_txq_copy(tag, 1);
+        queue_payload(data, len, owned);
+        ulwi_txq_static("\r\n", 2);
+    }
+    else if (framing == FRAME_XON_1)
+    {
+        ulwi_txq_static(XON_1, 1);
+        if (tag != NULL) ulwi_txq_copy(tag, 1);
+        queue_payload(data, len, owned);
+        ulwi_txq_static(XOFF_1, 1);
+    }
+    else if (framing == FRAME_XON_2)
+    {
+        ulwi_txq_static(XON_2, 1);
+        queue_payload(data, len, owned);
+        ulwi_txq_static(XOFF_2, 1);
+    }
+    else
+    {
+        free(owned);
+    }
+    ulwi_txq_drain();
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_reply_send                                             *
+ *                                                                            *
+ * PURPOSE: Queues a reply to the master for transmission over the UART. In   *
+ *          text mode the framing that was declared for the command is        *
+ *          applied, in binary mode the reply is sent as a frame carrying the *
+ *          command's opcode with BINARY_REPLY_FLAG set, which is binary      *
+ *          safe. In pipelining mode the tag of the command being dispatched  *
+ *          is echoed, and commands that reply nothing get an S. The buffer   *
+ *          of the reply is handed over to the transmit queue rather than     *
+ *          copied, leaving the mbuf empty.                                   *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE          I/O DESCRIPTION                                     *
+ * -------- ------------- --- -----------                                     *
+ * opcode   ulwi_opcode    I  The command that is being replied to            *
+ * framing  reply_framing  I  How the reply should be delimited in text mode  *
+ * reply    mbuf *        I/O The reply built by the handler                  *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+void ulwi_reply_send(enum ulwi_opcode opcode, enum reply_framing framing, struct mbuf *reply)
+{
+    if (current_deferred && reply->len == 0)
+    {
+        /* Sent by ulwi_reply_complete, or already answered as busy */
+    }
+    else if (framing != FRAME_NONE && borrowed_data != NULL && reply->len == 0)
+    {
+        send_reply(BINARY_REPLY_FLAG | opcode, framing, link_tagged ? &current_tag : NULL, borrowed_data, borrowed_len,
+                   NULL);
+    }
+    else if (framing != FRAME_NONE)
+    {
+        send_reply(BINARY_REPLY_FLAG | opcode, framing, link_tagged ? &current_tag : NULL, reply->buf, reply->len, reply->buf);
+        mbuf_init(reply, 0);
+    }
+    else if (link_tagged)
+    {
+        /* Commands that reply nothing are acknowledged so that the tag is released */
+        send_reply(BINARY_REPLY_FLAG | opcode, FRAME_CRLF, &current_tag, "S", 1, NULL);
+    }
+
+    borrowed_data = NULL;
+    borrowed_len = 0;
+    current_deferred = false;
+
+    /* A mode switch takes effect once its own reply has been sent */
+    link_mode = link_pending_mode;
+    link_tagged = link_pending_tagged;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_reply_borrow                                           *
+ *                                                                            *
+ * PURPOSE: Makes a buffer the whole reply of the current command, queued by  *
+ *          reference instead of copied. Whoever owns the buffer must call    *
+ *          ulwi_txq_detach before changing or freeing it, which copies what  *
+ *          has not been sent yet. The reply must be left otherwise empty.    *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE    I/O DESCRIPTION                                           *
+ * -------- ------- --- -----------                                           *
+ * data     char *   I  The reply payload, does not need termination          *
+ * len      size_t   I  Length of the reply payload                           *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+void ulwi_reply_borrow(const char *data, size_t len)
+{
+    borrowed_data = data;
+    borrowed_len = len;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_reply_error                                            *
+ *                                                                            *
+ * PURPOSE: Replies to a command that could not be run. In text mode this is  *
+ *          the "short", "long", "invalid" or "busy" reply, in binary mode it *
+ *          is a frame with an error opcode whose payload is the command      *
+ *          opcode.                                                           *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE          I/O DESCRIPTION                                     *
+ * -------- ------------- --- -----------                                     *
+ * opcode   ulwi_opcode    I  The command that failed, or OPCODE_INVALID      *
+ * error    reply_error    I  Why the command failed                          *
+ * framing  reply_framing  I  How the reply should be delimited in text mode  *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+void ulwi_reply_error(enum ulwi_opcode opcode, enum reply_error error, enum reply_framing framing)
+{
+    const char *tag = link_tagged ? &current_tag : NULL;
+
+    if (link_mode == LINK_BINARY)
+    {
+        const char payload = (char)opcode;
+        send_binary_frame(BINARY_ERROR_BASE + error, tag, &payload, 1, NULL);
+        ulwi_txq_drain();
+        return;
+    }
+
+    switch (error)
+    {
+    case REPLY_SHORT:
+        send_reply(0, framing, tag, "short", 5, NULL);
+        break;
+    case REPLY_LONG:
+        send_reply(0, framing, tag, "long", 4, NULL);
+        break;
+    case REPLY_BUSY:
+        send_reply(0, framing, tag, "busy", 4, NULL);
+        break;
+    case REPLY_INVALID:
+    case REPLY_CRC:
+        send_reply(0, framing, tag, "invalid", 7, NULL);
+        break;
+    }
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_reply_defer                                            *
+ *                                                                            *
+ * PURPOSE: Reserves a slot in the pipelining window for a command whose      *
+ *          reply is only sent once an asynchronous operation completes, such *
+ *          as lap. The sequence tag of the command is remembered so that the *
+ *          reply can be matched by the master when it eventually arrives,    *
+ *          out of order with the replies to later commands. The command      *
+ *          gets exactly one reply: an empty reply from its handler is not    *
+ *          sent, so it answers with ulwi_reply_error if no slot is free.     *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE         I/O DESCRIPTION                                      *
+ * -------- ------------ --- -----------                                      *
+ * opcode   ulwi_opcode   I  The command that will reply later                *
+ *                                                                            *
+ * RETURNS: the slot to pass to ulwi_reply_complete, or -1 if PIPELINE_WINDOW *
+ *          replies are already outstanding                                   *
+ *                                                                            *
+ *****************************************************************************/
+int ulwi_reply_defer(enum ulwi_opcode opcode)
+{
+    current_deferred = true;
+    for (int i = 0; i < PIPELINE_WINDOW; i++)
+    {
+        if (!deferred_replies[i].used)
+        {
+            deferred_replies[i].opcode = opcode;
+            deferred_replies[i].tagged = link_tagged;
+            deferred_replies[i].tag = current_tag;
+            deferred_replies[i].used = true;
+            return i;
+        }
+    }
+    return -1;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_reply_complete                                         *
+ *                                                                            *
+ * PURPOSE: Sends the reply of a command deferred by ulwi_reply_defer and     *
+ *          releases its slot in the pipelining window                        *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE          I/O DESCRIPTION                                     *
+ * -------- ------------- --- -----------                                     *
+ * slot     int            I  The slot returned by ulwi_reply_defer           *
+ * framing  reply_framing  I  How the reply should be delimited in text mode  *
+ * data     char *         I  The reply payload, does not need termination    *
+ * len      size_t         I  Length of the reply payload                     *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+void ulwi_reply_complete(int slot, enum reply_framing framing, const char *data, size_t len)
+{
+    if (slot < 0 || slot >= PIPELINE_WINDOW || !deferred_replies[slot].used)
+    {
+        return;
+    }
+    struct deferred_reply *deferred = &deferred_replies[slot];
+    send_reply(BINARY_REPLY_FLAG | deferred->opcode, framing, deferred->tagged ? &deferred->tag : NULL, data, len, NULL);
+    deferred->used = false;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_reply_set_tag                                          *
+ *                                                                            *
+ * PURPOSE: Sets the sequence tag of the command about to be dispatched,      *
+ *          which is echoed by every reply to it in pipelining mode           *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE    I/O DESCRIPTION                                           *
+ * -------- ------- --- -----------                                           *
+ * tag      char     I  The sequence tag                                      *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+void ulwi_reply_set_tag(char tag)
+{
+    current_tag = tag;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_reply_event                                            *
+ *                                                                            *
+ * PURPOSE: Sends an unsolicited event notification. In text mode it is       *
+ *          bracketed by XON_2/XOFF_2 so that it cannot be mistaken for a     *
+ *          reply, in binary mode it is a BINARY_EVENT frame. Replies are     *
+ *          queued whole, so an event always falls between two replies.       *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE    I/O DESCRIPTION                                           *
+ * -------- ------- --- -----------                                           *
+ * data     char *   I  The event, does not need termination                  *
+ * len      size_t   I  Length of the event                                   *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+void ulwi_reply_event(const char *data, size_t len)
+{
+    send_reply(BINARY_EVENT, FRAME_XON_2, NULL, data, len, NULL);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_link_mode                                              *
+ *                                                                            *
+ * PURPOSE: Returns whether the UART link is in text or binary frame mode     *
+ *                                                                            *
+ * ARGUMENTS: none                                                            *
+ *                                                                            *
+ * RETURNS: the current link_mode                                             *
+ *                                                                            *
+ *****************************************************************************/
+enum link_mode ulwi_link_mode(void)
+{
+    return link_mode;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_link_tagged                                            *
+ *                                                                            *
+ * PURPOSE: Returns whether commands carry a sequence tag (pipelining mode)   *
+ *                                                                            *
+ * ARGUMENTS: none                                                            *
+ *                                                                            *
+ * RETURNS: true if pipelining mode is enabled                                *
+ *                                                                            *
+ *****************************************************************************/
+bool ulwi_link_tagged(void)
+{
+    return link_tagged;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_link_request_mode                                      *
+ *                                                                            *
+ * PURPOSE: Switches the UART link between text and binary frame mode, and    *
+ *          enables or disables sequence tags. The switch is deferred until   *
+ *          the reply of the current command has been sent, so that reply     *
+ *          still uses the mode it was asked in.                              *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE       I/O DESCRIPTION                                        *
+ * -------- ---------- --- -----------                                        *
+ * mode     link_mode   I  The mode to switch to                              *
+ * tagged   bool        I  Whether commands and replies carry sequence tags   *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+void ulwi_link_request_mode(enum link_mode mode, bool tagged)
+{
+    link_pending_mode = mode;
+    link_pending_tagged = tagged;
+}
@@ -0,0 +1,67 @@
+/******************************************************************************
+ *                                                                            *
+ * NAME: reply.h                                                              *
+ *                                                                            *
+ * PURPOSE: Provides framed reply output from command handlers to the master  *
+ *                                                                            *
+ * GLOBAL VARIABLES:                                                          *
+ *                                                                            *
+ * Variable Type Description                                                  *
+ * -------- ---- -----------                                                  *
+ *                                                                            *
+ *                                                                            *
+ *****************************************************************************/
+
+#ifndef REPLY_H
+#define REPLY_H
+
+#include "mgos.h"
+
+#include "constants.h"
+
+/* Set on the opcode of every binary reply to a command */
+#define BINARY_REPLY_FLAG 0x80
+/* Opcode of the first binary error reply, followed by the other reply_error values */
+#define BINARY_ERROR_BASE 0xF0
+/* Opcode of binary event notifications */
+#define BINARY_EVENT 0xE0
+
+enum reply_framing
+{
+    FRAME_NONE,     /* Command does not reply, or replies asynchronously on its own.
+                       Pipelining mode acknowledges the former with S */
+    FRAME_CRLF,     /* Reply is terminated with a Windows style line ending */
+    FRAME_XON_1,    /* Reply is bracketed by the XON_1/XOFF_1 flow control characters */
+    FRAME_XON_2     /* Event is bracketed by the XON_2/XOFF_2 flow control characters */
+};
+
+enum reply_error
+{
+    REPLY_SHORT,    /* Command or its parameters are too short */
+    REPLY_LONG,     /* Command or its parameters are too long */
+    REPLY_INVALID,  /* Command is unknown or malformed */
+    REPLY_CRC,      /* Binary frame failed its CRC check */
+    REPLY_BUSY      /* PIPELINE_WINDOW replies are already outstanding */
+};
+
+enum link_mode
+{
+    LINK_TEXT,      /* Commands and replies are CRLF terminated text lines */
+    LINK_BINARY     /* Commands and replies are opcode/varint/payload/CRC-16 frames */
+};
+
+void ulwi_reply_puts(struct mbuf *reply, const char *str);
+void ulwi_reply_printf(struct mbuf *reply, const char *fmt, ...);
+void ulwi_reply_borrow(const char *data, size_t len);
+void ulwi_reply_send(enum ulwi_opcode opcode, enum reply_framing framing, struct mbuf *reply);
+void ulwi_reply_error(enum ulwi_opcode opcode, enum reply_error error, enum reply_framing framing);
+int ulwi_reply_defer(enum ulwi_opcode opcode);
+void ulwi_reply_complete(int slot, enum reply_framing framing, const char *data, size_t len);
+void ulwi_reply_set_tag(char tag);
+void ulwi_reply_event(const char *data, size_t len);
+
+enum link_mode ulwi_link_mode(void);
+bool ulwi_link_tagged(void);
+void ulwi_link_request_mode(enum link_mode mode, bool tagged);
+
+#endif
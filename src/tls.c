@@ -0,0 +1,478 @@
+#include "mbedtls/ssl.h"
+#include "mbedtls/x509_crt.h"
+#include "mbedtls/platform.h"
+
+#include "tls.h"
+#include "common.h"
+
+/* Start of the SSL state that mongoose keeps in nc->ssl_if_data. The full
+   struct mg_ssl_if_ctx is private to mg_ssl_if_mbedtls.c, but it begins with
+   the configuration and context of the connection, as in mongoose 6.x that
+   ships with Mongoose OS 2.x. Being private, its layout cannot be checked
+   when compiling, so connection_ssl checks that the context points back at
+   the configuration before trusting it */
+struct ssl_if_ctx_head
+{
+    mbedtls_ssl_config *conf;
+    mbedtls_ssl_context *ssl;
+};
+
+/* A session kept for a server */
+struct tls_entry
+{
+    char key[ULWI_SERVER_KEY_MAX];  /* Server of the session, empty if the entry is free */
+    mbedtls_ssl_session session;    /* Session without its peer certificate */
+    int64_t last_used;              /* When the session was last stored or offered */
+};
+
+/* A handshake in progress */
+struct tls_attempt
+{
+    struct mg_connection *nc;       /* NULL if the attempt is free */
+    char key[ULWI_SERVER_KEY_MAX];  /* Server being connected to */
+    int64_t started;                /* When the connection was made */
+    bool offered;                   /* Whether a cached session was offered to the server */
+    size_t id_len;                  /* Session ID offered, which the server echoes if it resumes */
+    unsigned char id[32];
+};
+
+static struct tls_entry cache[TLS_CACHE_MAX];
+static struct tls_attempt attempts[TLS_ATTEMPTS_MAX];
+static struct ulwi_tls_stats tls_stats;
+static mgos_timer_id save_timer = MGOS_INVALID_TIMER_ID;   /* Pending write of the cache to flash */
+
+/* Returns the mbedtls context of a TLS connection, NULL if it has none yet
+   or the SSL state of mongoose is not laid out as expected */
+static mbedtls_ssl_context *connection_ssl(struct mg_connection *nc)
+{
+    if (!(nc->flags & MG_F_SSL) || nc->ssl_if_data == NULL)
+    {
+        return NULL;
+    }
+    const struct ssl_if_ctx_head *head = (const struct ssl_if_ctx_head *)nc->ssl_if_data;
+    if (head->ssl == NULL || head->conf == NULL || head->ssl->conf != head->conf)
+    {
+        static bool warned = false;
+        if (!warned)
+        {
+            LOG(LL_ERROR, ("Unexpected mongoose SSL state, TLS sessions are not cached"));
+            warned = true;
+        }
+        return NULL;
+    }
+    return head->ssl;
+}
+
+static struct tls_entry *find_entry(const char *key)
+{
+    for (size_t i = 0; i < TLS_CACHE_MAX; i++)
+    {
+        if (cache[i].key[0] != '\0' && strcmp(cache[i].key, key) == 0)
+        {
+            return &cache[i];
+        }
+    }
+    return NULL;
+}
+
+static struct tls_attempt *find_attempt(struct mg_connection *nc)
+{
+    for (size_t i = 0; i < TLS_ATTEMPTS_MAX; i++)
+    {
+        if (attempts[i].nc == nc)
+        {
+            return &attempts[i];
+        }
+    }
+    return NULL;
+}
+
+static void free_entry(struct tls_entry *entry)
+{
+    mbedtls_ssl_session_free(&entry->session);
+    mbedtls_ssl_session_init(&entry->session);
+    entry->key[0] = '\0';
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: save_cache                                                  *
+ *                                                                            *
+ * PURPOSE: Writes every cached session to TLS_CACHE_FILE so that it survives *
+ *          a reset. Only the fields needed to resume are written: the        *
+ *          session ID, master secret, ciphersuite and ticket.                *
+ *                                                                            *
+ * ARGUMENTS: none                                                            *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+static void save_cache(void)
+{
+    FILE *file = fopen(TLS_CACHE_FILE, "wb");
+    if (file == NULL)
+    {
+        LOG(LL_ERROR, ("Cannot create %s", TLS_CACHE_FILE));
+        return;
+    }
+    for (size_t i = 0; i < TLS_CACHE_MAX; i++)
+    {
+        const struct tls_entry *entry = &cache[i];
+        if (entry->key[0] == '\0')
+        {
+            continue;
+        }
+        const mbedtls_ssl_session *session = &entry->session;
+        uint32_t fields[4] = {(uint32_t)session->ciphersuite, (uint32_t)session->compression,
+                              (uint32_t)session->id_len, 0};
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+        if (session->ticket_len <= TLS_TICKET_PERSIST_MAX)
+        {
+            fields[3] = (uint32_t)session->ticket_len;
+        }
+#endif
+        fwrite(entry->key, 1, sizeof(entry->key), file);
+        fwrite(fields, sizeof(fields[0]), 4, file);
+        fwrite(session->id, 1, sizeof(session->id), file);
+        fwrite(session->master, 1, sizeof(session->master), file);
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+        fwrite(&session->ticket_lifetime, sizeof(session->ticket_lifetime), 1, file);
+        if (fields[3] > 0)
+        {
+            fwrite(session->ticket, 1, fields[3], file);
+        }
+#endif
+    }
+    fclose(file);
+}
+
+/* Writes the cache once TLS_SAVE_DELAY_MS have passed since the first
+   handshake that changed it, so that a burst of handshakes costs one write */
+static void save_cache_cb(void *arg)
+{
+    save_timer = MGOS_INVALID_TIMER_ID;
+    if (mgos_sys_config_get_ulwi_tls_persist())
+    {
+        save_cache();
+    }
+    (void)arg;
+}
+
+static void cancel_save(void)
+{
+    mgos_clear_timer(save_timer);
+    save_timer = MGOS_INVALID_TIMER_ID;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: load_cache                                                  *
+ *                                                                            *
+ * PURPOSE: Reads the sessions written by save_cache back into the cache      *
+ *                                                                            *
+ * ARGUMENTS: none                                                            *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+static void load_cache(void)
+{
+    FILE *file = fopen(TLS_CACHE_FILE, "rb");
+    if (file == NULL)
+    {
+        return;
+    }
+    for (size_t i = 0; i < TLS_CACHE_MAX; i++)
+    {
+        struct tls_entry *entry = &cache[i];
+        mbedtls_ssl_session *session = &entry->session;
+        uint32_t fields[4];
+        if (fread(entry->key, 1, sizeof(entry->key), file) != sizeof(entry->key) ||
+            fread(fields, sizeof(fields[0]), 4, file) != 4 ||
+            fread(session->id, 1, sizeof(session->id), file) != sizeof(session->id) ||
+            fread(session->master, 1, sizeof(session->master), file) != sizeof(session->master) ||
+            fields[2] > sizeof(session->id) || fields[3] > TLS_TICKET_PERSIST_MAX)
+        {
+            free_entry(entry);
+            break;
+        }
+        entry->key[sizeof(entry->key) - 1] = '\0';
+        session->ciphersuite = (int)fields[0];
+        session->compression = (int)fields[1];
+        session->id_len = fields[2];
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+        bool complete = fread(&session->ticket_lifetime, sizeof(session->ticket_lifetime), 1, file) == 1;
+        if (complete && fields[3] > 0)
+        {
+            session->ticket = malloc(fields[3]);
+            complete = session->ticket != NULL && fread(session->ticket, 1, fields[3], file) == fields[3];
+            session->ticket_len = fields[3];
+        }
+        if (!complete)
+        {
+            free_entry(entry);
+            break;
+        }
+#endif
+        entry->last_used = mgos_uptime_micros();
+        LOG(LL_INFO, ("Loaded TLS session for %s", entry->key));
+    }
+    fclose(file);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_tls_init                                               *
+ *                                                                            *
+ * PURPOSE: Initialises the session cache, loading the sessions kept in flash *
+ *          if persistence was enabled with tsc                               *
+ *                                                                            *
+ * ARGUMENTS: none                                                            *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+void ulwi_tls_init(void)
+{
+    for (size_t i = 0; i < TLS_CACHE_MAX; i++)
+    {
+        mbedtls_ssl_session_init(&cache[i].session);
+    }
+    if (mgos_sys_config_get_ulwi_tls_persist())
+    {
+        load_cache();
+    }
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_tls_offer                                              *
+ *                                                                            *
+ * PURPOSE: Starts timing the handshake of a new connection, and offers the   *
+ *          cached session of its server for resumption. Must be called       *
+ *          before the handshake starts; does nothing for plain connections   *
+ *          and connections whose handshake has already started.              *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE           I/O DESCRIPTION                                    *
+ * -------- -------------- --- -----------                                    *
+ * nc       mg_connection * O  The connection                                 *
+ * key      char *          I  Key of the server, see ulwi_server_key         *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+void ulwi_tls_offer(struct mg_connection *nc, const char *key)
+{
+    mbedtls_ssl_context *ssl = connection_ssl(nc);
+    if (ssl == NULL || ssl->state != MBEDTLS_SSL_HELLO_REQUEST || find_attempt(nc) != NULL ||
+        strlen(key) >= ULWI_SERVER_KEY_MAX)
+    {
+        return;
+    }
+    struct tls_attempt *attempt = find_attempt(NULL);
+    if (attempt == NULL)
+    {
+        return;
+    }
+    attempt->nc = nc;
+    strcpy(attempt->key, key);
+    attempt->started = mgos_uptime_micros();
+    attempt->offered = false;
+
+    struct tls_entry *entry = find_entry(key);
+    if (entry != NULL && mbedtls_ssl_set_session(ssl, &entry->session) == 0)
+    {
+        attempt->offered = true;
+        attempt->id_len = entry->session.id_len;
+        memcpy(attempt->id, entry->session.id, sizeof(attempt->id));
+        entry->last_used = attempt->started;
+    }
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_tls_established                                        *
+ *                                                                            *
+ * PURPOSE: Records the time of a completed handshake, and caches the session *
+ *          of the connection for the next connection to the same server      *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE           I/O DESCRIPTION                                    *
+ * -------- -------------- --- -----------                                    *
+ * nc       mg_connection * I  The connection, on MG_EV_CONNECT               *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+void ulwi_tls_established(struct mg_connection *nc)
+{
+    struct tls_attempt *attempt = find_attempt(nc);
+    mbedtls_ssl_context *ssl = connection_ssl(nc);
+    if (attempt == NULL || ssl == NULL)
+    {
+        return;
+    }
+    const int64_t elapsed = mgos_uptime_micros() - attempt->started;
+    attempt->nc = NULL;
+
+    mbedtls_ssl_session session;
+    mbedtls_ssl_session_init(&session);
+    if (mbedtls_ssl_get_session(ssl, &session) != 0)
+    {
+        mbedtls_ssl_session_free(&session);
+        return;
+    }
+    /* The server echoes the offered session ID only when it resumes */
+    const bool resumed = attempt->offered && session.id_len == attempt->id_len &&
+                         memcmp(session.id, attempt->id, session.id_len) == 0;
+    if (resumed)
+    {
+        tls_stats.resumed++;
+        tls_stats.resumed_micros += elapsed;
+    }
+    else
+    {
+        tls_stats.full++;
+        tls_stats.full_micros += elapsed;
+    }
+    LOG(LL_INFO, ("%s TLS handshake with %s took %lld ms", resumed ? "Resumed" : "Full",
+                  attempt->key, (long long)(elapsed / 1000)));
+
+    /* The certificate was verified already and is not needed to resume, and
+       a parsed chain takes kilobytes of heap */
+    if (session.peer_cert != NULL)
+    {
+        mbedtls_x509_crt_free(session.peer_cert);
+        mbedtls_free(session.peer_cert);
+        session.peer_cert = NULL;
+    }
+
+    struct tls_entry *entry = find_entry(attempt->key);
+    if (entry == NULL)
+    {
+        entry = &cache[0];
+        for (size_t i = 0; i < TLS_CACHE_MAX; i++)
+        {
+            if (cache[i].key[0] == '\0')
+            {
+                entry = &cache[i];
+                break;
+            }
+            if (cache[i].last_used < entry->last_used)
+            {
+                entry = &cache[i];
+            }
+        }
+    }
+    free_entry(entry);
+    strcpy(entry->key, attempt->key);
+    entry->session = session;
+    entry->last_used = mgos_uptime_micros();
+    if (mgos_sys_config_get_ulwi_tls_persist() && !resumed && save_timer == MGOS_INVALID_TIMER_ID)
+    {
+        save_timer = mgos_set_timer(TLS_SAVE_DELAY_MS, 0, save_cache_cb, NULL);
+    }
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_tls_forget                                             *
+ *                                                                            *
+ * PURPOSE: Stops timing the handshake of a connection that has closed. A     *
+ *          session whose offer ended in a failed handshake is dropped, so    *
+ *          that the next connection to the server does a full handshake.     *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE           I/O DESCRIPTION                                    *
+ * -------- -------------- --- -----------                                    *
+ * nc       mg_connection * I  The connection, on MG_EV_CLOSE                 *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+void ulwi_tls_forget(struct mg_connection *nc)
+{
+    struct tls_attempt *attempt = find_attempt(nc);
+    if (attempt == NULL)
+    {
+        return;
+    }
+    attempt->nc = NULL;
+    struct tls_entry *entry = find_entry(attempt->key);
+    if (attempt->offered && entry != NULL)
+    {
+        LOG(LL_WARN, ("TLS handshake with %s failed, dropping its session", attempt->key));
+        free_entry(entry);
+    }
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_tls_clear                                              *
+ *                                                                            *
+ * PURPOSE: Drops every cached session and resets the handshake statistics    *
+ *                                                                            *
+ * ARGUMENTS: none                                                            *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+void ulwi_tls_clear(void)
+{
+    for (size_t i = 0; i < TLS_CACHE_MAX; i++)
+    {
+        free_entry(&cache[i]);
+    }
+    memset(&tls_stats, 0, sizeof(tls_stats));
+    cancel_save();
+    remove(TLS_CACHE_FILE);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_tls_set_persist                                        *
+ *                                                                            *
+ * PURPOSE: Enables or disables keeping sessions in flash across resets, and  *
+ *          saves the setting. Disabling it deletes the sessions in flash.    *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE    I/O DESCRIPTION                                           *
+ * -------- ------- --- -----------                                           *
+ * persist  bool     I  Whether to keep sessions in flash                     *
+ *                                                                            *
+ * RETURNS: false if the setting could not be saved                           *
+ *                                                                            *
+ *****************************************************************************/
+bool ulwi_tls_set_persist(bool persist)
+{
+    char *msg = NULL;
+    mgos_sys_config_set_ulwi_tls_persist(persist);
+    if (!save_cfg(&mgos_sys_config, &msg))
+    {
+        LOG(LL_ERROR, ("Failed to save TLS persistence: %s", msg ? msg : ""));
+        free(msg);
+        return false;
+    }
+    free(msg);
+    cancel_save();
+    if (persist)
+    {
+        save_cache();
+    }
+    else
+    {
+        remove(TLS_CACHE_FILE);
+    }
+    return true;
+}
+
+/* Returns the handshake counters and times */
+const struct ulwi_tls_stats *ulwi_tls_get_stats(void)
+{
+    return &tls_stats;
+}
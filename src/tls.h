@@ -0,0 +1,57 @@
+/******************************************************************************
+ *                                                                            *
+ * NAME: tls.h                                                                *
+ *                                                                            *
+ * PURPOSE: Provides a TLS session cache so that reconnects to a server skip  *
+ *          the full handshake                                                *
+ *                                                                            *
+ * GLOBAL VARIABLES:                                                          *
+ *                                                                            *
+ * Variable Type Description                                                  *
+ * -------- ---- -----------                                                  *
+ *                                                                            *
+ *                                                                            *
+ *****************************************************************************/
+
+#ifndef TLS_H
+#define TLS_H
+
+#include "mgos.h"
+
+#include "constants.h"
+
+/* Servers whose sessions are kept, the least recently used is replaced */
+#ifndef TLS_CACHE_MAX
+#define TLS_CACHE_MAX 4
+#endif
+/* Handshakes that can be timed at once, further ones are neither timed nor resumed */
+#ifndef TLS_ATTEMPTS_MAX
+#define TLS_ATTEMPTS_MAX 4
+#endif
+/* Longest session ticket written to flash, longer tickets are only kept in RAM */
+#define TLS_TICKET_PERSIST_MAX 512
+/* Delay before sessions from new full handshakes are written to flash, which
+   batches the writes of handshakes in between */
+#ifndef TLS_SAVE_DELAY_MS
+#define TLS_SAVE_DELAY_MS 60000
+#endif
+/* File in flash that sessions are kept in across resets */
+#define TLS_CACHE_FILE "ulwi_tls.dat"
+
+struct ulwi_tls_stats
+{
+    uint32_t full;              /* Full handshakes completed */
+    uint32_t resumed;           /* Abbreviated handshakes that resumed a cached session */
+    uint64_t full_micros;       /* Total time of the full handshakes */
+    uint64_t resumed_micros;    /* Total time of the resumed handshakes */
+};
+
+void ulwi_tls_init(void);
+void ulwi_tls_offer(struct mg_connection *nc, const char *key);
+void ulwi_tls_established(struct mg_connection *nc);
+void ulwi_tls_forget(struct mg_connection *nc);
+void ulwi_tls_clear(void);
+bool ulwi_tls_set_persist(bool persist);
+const struct ulwi_tls_stats *ulwi_tls_get_stats(void);
+
+#endif
@@ -0,0 +1,458 @@
+#include "txqueue.h"
+#include "constants.h"
+
+/* A buffer waiting to be written to the UART */
+struct tx_segment
+{
+    const char *data;                   /* Start of the buffer */
+    size_t len;                         /* Length of the buffer */
+    size_t sent;                        /* Bytes already written to the UART */
+    char *owned;                        /* Freed once sent, NULL if the buffer is inline or static */
+    char inline_data[TXQ_INLINE_MAX];   /* Storage for short buffers */
+};
+
+/* Ring of segments, sent in order from head */
+static struct
+{
+    struct tx_segment segments[TXQ_SEGMENTS];
+    size_t head;
+    size_t count;
+    bool stalled;               /* Whether output is waiting for space in the UART */
+    int64_t stall_started;      /* When output started waiting */
+} txq;
+
+static struct ulwi_txq_stats txq_stats;
+
+/* Receiver driven flow control of the output, see ulwi_txq_set_flow */
+static struct
+{
+    enum flow_control mode;
+    size_t chunk_size;          /* Bytes that may be sent per grant or per gap */
+    int gap_ms;                 /* Pause after every chunk in paced mode */
+    long allowance;             /* Bytes that may be sent before the next grant or gap, negative after a flush */
+    int64_t exhausted_at;       /* When the allowance ran out in paced mode */
+    mgos_timer_id timer;        /* Ends the gap in paced mode */
+    bool bypass;                /* Whether ulwi_txq_flush is overriding flow control */
+} flow;
+
+/* Appends a buffer to the last segment, when every segment is in use, so
+   that output keeps waiting for flow control instead of being flushed */
+static bool txq_merge(const char *data, size_t len)
+{
+    struct tx_segment *tail = &txq.segments[(txq.head + txq.count - 1) % TXQ_SEGMENTS];
+    const size_t remaining = tail->len - tail->sent;
+    char *merged = malloc(remaining + len);
+    if (merged == NULL)
+    {
+        return false;
+    }
+    memcpy(merged, tail->data + tail->sent, remaining);
+    memcpy(merged + remaining, data, len);
+    free(tail->owned);
+    tail->data = merged;
+    tail->len = remaining + len;
+    tail->sent = 0;
+    tail->owned = merged;
+    return true;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: txq_push                                                    *
+ *                                                                            *
+ * PURPOSE: Appends a buffer to the queue. If every segment is in use, it is  *
+ *          merged into the last segment instead, which keeps flow control in *
+ *          force; only if the heap cannot hold the merge is the queue        *
+ *          flushed first, which blocks until the UART has taken it.          *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE    I/O DESCRIPTION                                           *
+ * -------- ------- --- -----------                                           *
+ * data     char *   I  Start of the buffer                                   *
+ * len      size_t   I  Length of the buffer                                  *
+ * owned    char *   I  Buffer to free once sent, or NULL                     *
+ * copy     bool     I  Whether to copy the buffer into the segment itself,   *
+ *                      for buffers of up to TXQ_INLINE_MAX bytes             *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+static void txq_push(const char *data, size_t len, char *owned, bool copy)
+{
+    txq_stats.depth += len;
+    if (txq_stats.depth > txq_stats.max_depth)
+    {
+        txq_stats.max_depth = txq_stats.depth;
+    }
+    if (txq.count == TXQ_SEGMENTS)
+    {
+        if (txq_merge(data, len))
+        {
+            free(owned);
+            return;
+        }
+        LOG(LL_ERROR, ("Out of memory merging %u bytes, flushing", (unsigned)len));
+        ulwi_txq_flush();
+    }
+    struct tx_segment *segment = &txq.segments[(txq.head + txq.count) % TXQ_SEGMENTS];
+    txq.count++;
+    segment->len = len;
+    segment->sent = 0;
+    segment->owned = owned;
+    if (copy)
+    {
+        memcpy(segment->inline_data, data, len);
+        segment->data = segment->inline_data;
+    }
+    else
+    {
+        segment->data = data;
+    }
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_txq_copy                                               *
+ *                                                                            *
+ * PURPOSE: Queues a copy of a buffer that may change or be freed before it   *
+ *          is sent. Short buffers are copied into the queue itself.          *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE    I/O DESCRIPTION                                           *
+ * -------- ------- --- -----------                                           *
+ * data     void *   I  The buffer to send                                    *
+ * len      size_t   I  Length of the buffer                                  *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+void ulwi_txq_copy(const void *data, size_t len)
+{
+    if (len == 0)
+    {
+        return;
+    }
+    if (len <= TXQ_INLINE_MAX)
+    {
+        txq_push(data, len, NULL, true);
+        return;
+    }
+    char *copy = malloc(len);
+    if (copy == NULL)
+    {
+        LOG(LL_ERROR, ("Out of memory queueing %u bytes", (unsigned)len));
+        return;
+    }
+    memcpy(copy, data, len);
+    txq_push(copy, len, copy, false);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_txq_static                                             *
+ *                                                                            *
+ * PURPOSE: Queues a reference to a buffer that is never freed, such as a     *
+ *          string literal, without copying it                               *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE    I/O DESCRIPTION                                           *
+ * -------- ------- --- -----------                                           *
+ * data     void *   I  The buffer to send                                    *
+ * len      size_t   I  Length of the buffer                                  *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+void ulwi_txq_static(const void *data, size_t len)
+{
+    if (len > 0)
+    {
+        txq_push(data, len, NULL, false);
+    }
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_txq_adopt                                              *
+ *                                                                            *
+ * PURPOSE: Queues a heap buffer without copying it. The queue takes          *
+ *          ownership of the buffer and frees it once it has been sent.       *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE    I/O DESCRIPTION                                           *
+ * -------- ------- --- -----------                                           *
+ * buf      char *   I  The malloc'd buffer to send                           *
+ * len      size_t   I  Length of the buffer                                  *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+void ulwi_txq_adopt(char *buf, size_t len)
+{
+    if (len == 0)
+    {
+        free(buf);
+        return;
+    }
+    txq_push(buf, len, buf, false);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_txq_detach                                             *
+ *                                                                            *
+ * PURPOSE: Copies out whatever is still queued by reference from a buffer   *
+ *          that is about to change or be freed, so that replies can be       *
+ *          queued straight from the buffers of responses and messages and   *
+ *          only pay for a copy when the buffer goes away before they are    *
+ *          sent. If the heap cannot hold the copy, the queue is flushed.     *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT TYPE    I/O DESCRIPTION                                           *
+ * -------- ------- --- -----------                                           *
+ * base     void *   I  Start of the buffer                                   *
+ * size     size_t   I  Size of the buffer                                    *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+void ulwi_txq_detach(const void *base, size_t size)
+{
+    const char *start = (const char *)base;
+    for (size_t i = 0; i < txq.count && start != NULL; i++)
+    {
+        struct tx_segment *segment = &txq.segments[(txq.head + i) % TXQ_SEGMENTS];
+        if (segment->owned != NULL || segment->data < start || segment->data >= start + size)
+        {
+            continue;
+        }
+        const size_t remaining = segment->len - segment->sent;
+        char *copy = malloc(remaining);
+        if (copy == NULL)
+        {
+            LOG(LL_ERROR, ("Out of memory detaching %u bytes, flushing", (unsigned)remaining));
+            ulwi_txq_flush();
+            return;
+        }
+        memcpy(copy, segment->data + segment->sent, remaining);
+        segment->data = copy;
+        segment->len = remaining;
+        segment->sent = 0;
+        segment->owned = copy;
+    }
+}
+
+static void flow_gap_cb(void *arg)
+{
+    flow.timer = MGOS_INVALID_TIMER_ID;
+    ulwi_txq_drain();
+    (void)arg;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_txq_drain                                              *
+ *                                                                            *
+ * PURPOSE: Hands as much of the queue to the UART as fits in its transmit    *
+ *          buffer without blocking. Called whenever something is queued and  *
+ *          from the UART dispatcher, which runs again when the UART has      *
+ *          space in its transmit buffer, so a long reply is sent over many   *
+ *          turns of the event loop instead of stalling it. Output is also    *
+ *          limited by the flow control mode set with ulwi_txq_set_flow.      *
+ *                                                                            *
+ * ARGUMENTS: none                                                            *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+void ulwi_txq_drain(void)
+{
+    size_t avail = mgos_uart_write_avail(UART_NO);
+    if (flow.mode != FLOW_NONE && !flow.bypass)
+    {
+        if (flow.mode == FLOW_PACED && flow.allowance <= 0 &&
+            mgos_uptime_micros() - flow.exhausted_at >= (int64_t)flow.gap_ms * 1000)
+        {
+            /* The gap after the last chunk has passed */
+            flow.allowance = flow.chunk_size;
+        }
+        const size_t allowance = flow.allowance > 0 ? (size_t)flow.allowance : 0;
+        avail = allowance < avail ? allowance : avail;
+    }
+    const bool exhausted = flow.allowance <= 0;
+    if (txq.stalled && avail > 0)
+    {
+        txq_stats.stall_micros += mgos_uptime_micros() - txq.stall_started;
+        txq.stalled = false;
+    }
+
+    while (txq.count > 0 && avail > 0)
+    {
+        struct tx_segment *segment = &txq.segments[txq.head];
+        const size_t remaining = segment->len - segment->sent;
+        const size_t n = remaining < avail ? remaining : avail;
+        mgos_uart_write(UART_NO, segment->data + segment->sent, n);
+        segment->sent += n;
+        txq_stats.depth -= n;
+        flow.allowance -= n;
+        avail -= n;
+
+        if (segment->sent == segment->len)
+        {
+            free(segment->owned);
+            segment->owned = NULL;
+            txq.head = (txq.head + 1) % TXQ_SEGMENTS;
+            txq.count--;
+        }
+    }
+    if (flow.mode == FLOW_PACED && flow.allowance <= 0)
+    {
+        const int64_t now = mgos_uptime_micros();
+        if (!exhausted)
+        {
+            /* The gap only starts when the chunk runs out, not on every pass */
+            flow.exhausted_at = now;
+        }
+        if (txq.count > 0 && flow.timer == MGOS_INVALID_TIMER_ID)
+        {
+            const int64_t left = (int64_t)flow.gap_ms * 1000 - (now - flow.exhausted_at);
+            flow.timer = mgos_set_timer(left > 0 ? (int)((left + 999) / 1000) : 0, 0, flow_gap_cb, NULL);
+        }
+    }
+
+    if (txq.count > 0 && !txq.stalled)
+    {
+        txq.stalled = true;
+        txq.stall_started = mgos_uptime_micros();
+        txq_stats.stalls++;
+    }
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_txq_flush                                              *
+ *                                                                            *
+ * PURPOSE: Blocks until everything queued has been sent, for when the UART   *
+ *          is about to be reconfigured, or as a last resort when the heap    *
+ *          cannot hold more output.                                          *
+ *          Flow control is overridden, but the bytes sent still count        *
+ *          against the credit of the master.                                 *
+ *                                                                            *
+ * ARGUMENTS: none                                                            *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+void ulwi_txq_flush(void)
+{
+    if (txq.count > 0)
+    {
+        txq_stats.flushes++;
+    }
+    flow.bypass = true;
+    while (txq.count > 0)
+    {
+        ulwi_txq_drain();
+        if (txq.count > 0)
+        {
+            mgos_uart_flush(UART_NO);
+        }
+    }
+    flow.bypass = false;
+    mgos_uart_flush(UART_NO);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_txq_get_stats                                          *
+ *                                                                            *
+ * PURPOSE: Returns the queue depth and stall counters of the transmit queue  *
+ *                                                                            *
+ * ARGUMENTS: none                                                            *
+ *                                                                            *
+ * RETURNS: the counters, valid until the next call into the queue            *
+ *                                                                            *
+ *****************************************************************************/
+const struct ulwi_txq_stats *ulwi_txq_get_stats(void)
+{
+    return &txq_stats;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_txq_set_flow                                           *
+ *                                                                            *
+ * PURPOSE: Sets how output is throttled for masters with small receive       *
+ *          buffers. In credit mode up to chunk_size bytes are sent, after    *
+ *          which output waits until the master has sent a CREDIT_GRANT for   *
+ *          every chunk_size bytes it has read. In paced mode output pauses   *
+ *          for gap_ms after every chunk_size bytes instead. The counting     *
+ *          starts afresh with the next byte queued.                          *
+ *                                                                            *
+ * ARGUMENTS:                                                                 *
+ *                                                                            *
+ * ARGUMENT   TYPE          I/O DESCRIPTION                                   *
+ * ---------- ------------- --- -----------                                   *
+ * mode       flow_control   I  The flow control mode                         *
+ * chunk_size size_t         I  Bytes sent per grant or per gap               *
+ * gap_ms     int            I  Pause after every chunk in paced mode         *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+void ulwi_txq_set_flow(enum flow_control mode, size_t chunk_size, int gap_ms)
+{
+    /* Output already queued is sent under the old mode */
+    ulwi_txq_flush();
+    mgos_clear_timer(flow.timer);
+    flow.timer = MGOS_INVALID_TIMER_ID;
+
+    flow.mode = mode;
+    flow.chunk_size = chunk_size;
+    flow.gap_ms = gap_ms;
+    flow.allowance = chunk_size;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_txq_flow                                               *
+ *                                                                            *
+ * PURPOSE: Returns the flow control mode of the output                       *
+ *                                                                            *
+ * ARGUMENTS: none                                                            *
+ *                                                                            *
+ * RETURNS: the current flow_control                                          *
+ *                                                                            *
+ *****************************************************************************/
+enum flow_control ulwi_txq_flow(void)
+{
+    return flow.mode;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_txq_grant                                              *
+ *                                                                            *
+ * PURPOSE: Called when the master sends a CREDIT_GRANT in credit mode,       *
+ *          allowing another chunk of output to be sent                       *
+ *                                                                            *
+ * ARGUMENTS: none                                                            *
+ *                                                                            *
+ * RETURNS: none                                                              *
+ *                                                                            *
+ *****************************************************************************/
+void ulwi_txq_grant(void)
+{
+    if (flow.mode != FLOW_CREDIT)
+    {
+        return;
+    }
+    txq_stats.grants++;
+    flow.allowance += flow.chunk_size;
+    ulwi_txq_drain();
+}
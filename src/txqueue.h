@@ -0,0 +1,61 @@
+/******************************************************************************
+ *                                                                            *
+ * NAME: txqueue.h                                                            *
+ *                                                                            *
+ * PURPOSE: Provides a non-blocking transmit queue for the UART link          *
+ *                                                                            *
+ * GLOBAL VARIABLES:                                                          *
+ *                                                                            *
+ * Variable Type Description                                                  *
+ * -------- ---- -----------                                                  *
+ *                                                                            *
+ *                                                                            *
+ *****************************************************************************/
+
+#ifndef TXQUEUE_H
+#define TXQUEUE_H
+
+#include "mgos.h"
+
+/* Number of buffers that can be waiting to be sent. A reply takes 2 to 4 */
+#define TXQ_SEGMENTS 32
+/* Buffers up to this length (framing, tags, CRCs) are copied into the queue */
+#define TXQ_INLINE_MAX 8
+
+/* Byte sent by the master in credit mode to allow another chunk of output */
+#define CREDIT_GRANT 0xFE
+/* Bounds of the chunk size and gap accepted by the sfc command */
+#define FLOW_CHUNK_MIN 8
+#define FLOW_CHUNK_MAX 1024
+#define FLOW_GAP_MAX 1000
+
+enum flow_control
+{
+    FLOW_NONE,      /* Output is only limited by the UART */
+    FLOW_CREDIT,    /* Each chunk of output waits for a CREDIT_GRANT from the master */
+    FLOW_PACED      /* Each chunk of output is followed by a fixed gap */
+};
+
+struct ulwi_txq_stats
+{
+    size_t depth;               /* Bytes waiting to be handed to the UART */
+    size_t max_depth;           /* Highest depth seen */
+    uint32_t stalls;            /* Times output had to wait for the UART or flow control */
+    uint64_t stall_micros;      /* Total time output waited for the UART or flow control */
+    uint32_t flushes;           /* Times the event loop was blocked to empty the queue */
+    uint32_t grants;            /* Credit grants received from the master */
+};
+
+void ulwi_txq_copy(const void *data, size_t len);
+void ulwi_txq_static(const void *data, size_t len);
+void ulwi_txq_adopt(char *buf, size_t len);
+void ulwi_txq_detach(const void *base, size_t size);
+void ulwi_txq_drain(void);
+void ulwi_txq_flush(void);
+const struct ulwi_txq_stats *ulwi_txq_get_stats(void);
+
+void ulwi_txq_set_flow(enum flow_control mode, size_t chunk_size, int gap_ms);
+enum flow_control ulwi_txq_flow(void);
+void ulwi_txq_grant(void);
+
+#endif
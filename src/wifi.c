@@ -1,6 +1,8 @@
 #include "wifi.h"
 
 #include "constants.h"
+#include "reply.h"
+#include "event.h"
 
 /******************************************************************************
  *                                                                            *
@@ -51,16 +53,19 @@ void wifi_cb(int ev, void *evd, void *arg) {
         struct mgos_wifi_sta_disconnected_arg *da =
             (struct mgos_wifi_sta_disconnected_arg *) evd;
         LOG(LL_INFO, ("WiFi STA disconnected, reason %d", da->reason));
+        ulwi_event_wifi('N');
         break;
     }
     case MGOS_WIFI_EV_STA_CONNECTING:
         LOG(LL_INFO, ("WiFi STA connecting %p", arg));
+        ulwi_event_wifi('P');
         break;
     case MGOS_WIFI_EV_STA_CONNECTED:
         LOG(LL_INFO, ("WiFi STA connected %p", arg));
         break;
     case MGOS_WIFI_EV_STA_IP_ACQUIRED:
         LOG(LL_INFO, ("WiFi STA IP acquired %p", arg));
+        ulwi_event_wifi('S');
         break;
     case MGOS_WIFI_EV_AP_STA_CONNECTED: {
         struct mgos_wifi_ap_sta_connected_arg *aa =
@@ -96,23 +101,26 @@ void wifi_cb(int ev, void *evd, void *arg) {
  * -------- ------- --- -----------                                           *
  * n        int      I  Number of Wi-Fi hotspots scanned                      *
  * res      struct   O  Result of the scan in an mgos_wifi_scan_result struct *
- * arg      void     O                                                        *
+ * arg      void     I  The deferred reply slot of the lap command            *
  *                                                                            *
  * RETURNS: none                                                              *
  *                                                                            *
  *****************************************************************************/
 void wifi_scan_cb(int n, struct mgos_wifi_scan_result *res, void *arg)
 {
+    struct mbuf reply;
+    mbuf_init(&reply, 0);
     qsort(res, n, sizeof(struct mgos_wifi_scan_result), compare_larger_rssi); /* Sort by RSSI descending */
     for (int i = 0; i < n; i++)
     {
         if (i > 0)
         {
-            mgos_uart_printf(UART_NO, ",");
+            ulwi_reply_puts(&reply, ",");
         }
-        mgos_uart_printf(UART_NO, "%s", res[i].ssid);
+        ulwi_reply_puts(&reply, res[i].ssid);
     }
-    mgos_uart_printf(UART_NO, "\r\n");
+    ulwi_reply_complete((int)(intptr_t)arg, FRAME_CRLF, reply.buf, reply.len);
+    mbuf_free(&reply);
     /* Turn off AP mode radio once complete with scan */
     /* TODO: if AP mode is implemented in the future, do not turn off AP mode */
     const struct mgos_config_wifi_ap ap_config = 
@@ -120,5 +128,55 @@ void wifi_scan_cb(int n, struct mgos_wifi_scan_result *res, void *arg)
         .enable = false
     };
     mgos_wifi_setup_ap(&ap_config);
-    (void)arg;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * FUNCTION NAME: ulwi_wifi_state                                             *
+ *                                                                            *
+ * PURPOSE: Returns the state of the connection to the access point, as       *
+ *          replied by sap                                                    *
+ *                                                                            *
+ * ARGUMENTS: none                                                            *
+ *                                                                            *
+ * RETURNS: N if disconnected, P if connecting, S if connected or U if the    *
+ *          state is unknown                                                  *
+ *                                                                            *
+ *****************************************************************************/
+char ulwi_wifi_state(void)
+{
+    char state;
+    const enum mgos_wifi_status wifi_status = mgos_wifi_get_status();
+    char *ssid = mgos_wifi_get_connected_ssid();
+    switch (wifi_status)
+    {
+    case MGOS_WIFI_DISCONNECTED:
+        state = 'N';
+        break;
+    case MGOS_WIFI_CONNECTING:
+        state = 'P';
+        break;
+    case MGOS_WIFI_CONNECTED:
+        /* TODO: need to implement differentiation between connected and IP acquired,
+                 as some Wi-Fi environments do NOT use DHCP */
+        /* this condition is fallthrough */
+    case MGOS_WIFI_IP_ACQUIRED:
+        if (ssid)
+        {
+            state = 'S';
+        }
+        else
+        {
+            /* This case occurs when Wi-Fi connection was JUST established and
+               might not constitute an error */
+            state = 'P';
+            LOG(LL_DEBUG, ("Wifi IP acquired but SSID is null"));
+        }
+        break;
+    default:
+        state = 'U';
+        break;
+    }
+    free(ssid);
+    return state;
 }
@@ -19,5 +19,6 @@
 
 void wifi_cb(int ev, void *evd, void *arg);
 void wifi_scan_cb(int n, struct mgos_wifi_scan_result *res, void *arg);
+char ulwi_wifi_state(void);
 
 #endif
\ No newline at end of file